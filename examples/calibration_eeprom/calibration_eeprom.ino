@@ -1,7 +1,7 @@
 #include "MPU9250.h"
 #include "eeprom_utils.h"
 
-MPU9250 mpu;
+MPU9250::MPU mpu;
 
 void setup() {
     Serial.begin(115200);
@@ -15,9 +15,7 @@ void setup() {
         }
     }
 
-#if defined(ESP_PLATFORM) || defined(ESP8266)
-    EEPROM.begin(0x80);
-#endif
+    setupEEPROM();
 
     delay(5000);
 
@@ -39,8 +37,8 @@ void setup() {
     // save to eeprom
     saveCalibration();
 
-    // load from eeprom
-    loadCalibration();
+    // on the next boot, loadCalibration(addr, driver, filter) replaces
+    // setup() and the calibration above
 }
 
 void loop() {
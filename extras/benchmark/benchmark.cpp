@@ -0,0 +1,518 @@
+// Per-sample cost of the update path, run against SimulatedDriver.
+//
+//   mpu9250_benchmark [--json] [--samples N] [-o file]
+//
+// Every row reports host ns/sample and, for cases that touch the bus,
+// bytes/sample and the time those bytes take on a 400 kHz I2C bus, which
+// is what dominates on a microcontroller. Output is CSV (default) or JSON,
+// one record per case, so results can be diffed between commits.
+//
+// The correctness checks of these kernels are in tests/mpu9250_tests.cpp.
+
+#include "SimulatedDriver.h"
+#include "ThreadedBus.h"
+#include <EskfFilter.h>
+#include <FilterBank.h>
+#include <FixedFilter.h>
+#include <FrameDecode.h>
+#include <MPU9250Array.h>
+#include <MPU9250Impl.h>  // BasicMPU<FilterT> with concrete filters
+#include <QuaternionFilter.h>
+#include <SampleQueue.h>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MPU9250;
+
+namespace {
+
+struct Result {
+	std::string bench;
+	std::string filter;
+	size_t iterations;
+	uint64_t samples;
+	double ns_per_sample;
+	double bytes_per_sample;
+	double bus_us_per_sample;
+};
+
+volatile float sink;
+
+double elapsed_ns(std::chrono::steady_clock::time_point start) {
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void configure_errors(SimulatedDriver& d) {
+	d.errors.acc_noise = 0.002f;
+	d.errors.gyro_noise = 0.05f;
+	d.errors.mag_noise = 1.f;
+}
+
+Result bus_result(const char* bench, const char* filter, size_t iterations,
+                  uint64_t samples, double ns, const SimulatedDriver& d) {
+	const SimulatedDriver::Stats& s = d.stats();
+	double bytes = (double)(s.bytes_read + s.bytes_written);
+	// address byte per transaction + data bytes, 9 clocks each
+	double bus_us = (double)(s.transactions + bytes) * 9. * 1e6 / d.bus_hz;
+	Result r {bench, filter, iterations, samples, 0., 0., 0.};
+	if (samples) {
+		r.ns_per_sample = ns / samples;
+		r.bytes_per_sample = bytes / samples;
+		r.bus_us_per_sample = bus_us / samples;
+	}
+	return r;
+}
+
+// MPU::update() end to end: poll, read, scale, filter, rpy. With a fixed
+// point FilterT the filter is fed from the raw counts.
+template <typename FilterT>
+Result bench_update(const char* name, FilterT& filter, size_t iterations, bool master, uint64_t n) {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	configure_errors(d);
+	BasicMPU<FilterT> mpu;
+	Setting setting;
+	setting.mag_via_i2c_master = master;
+	mpu.setup(0x68, d, filter, setting);
+	mpu.setFilterIterations(iterations);
+
+	d.resetStats();
+	uint64_t samples = 0;
+	double ns = 0.;
+	while (samples < n) {
+		d.advance(5000);  // one 200 Hz sample period
+		auto start = std::chrono::steady_clock::now();
+		if (mpu.update())
+			++samples;
+		ns += elapsed_ns(start);
+	}
+	sink = mpu.getYaw();
+	return bus_result(master ? "update_master" : "update", name, iterations, samples, ns, d);
+}
+
+Result bench_update_accel_gyro(uint64_t n) {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	configure_errors(d);
+	MPU mpu;
+	SimpleFilter filter;
+	mpu.setup(0x68, d, filter);
+
+	d.resetStats();
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < n; ++i)
+		mpu.update_accel_gyro();
+	double ns = elapsed_ns(start);
+	sink = mpu.getAccZ();
+	return bus_result("update_accel_gyro", "-", 0, n, ns, d);
+}
+
+Result bench_update_mag(uint64_t n) {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	configure_errors(d);
+	MPU mpu;
+	SimpleFilter filter;
+	mpu.setup(0x68, d, filter);
+
+	d.resetStats();
+	double ns = 0.;
+	for (uint64_t i = 0; i < n; ++i) {
+		d.advance(10000);  // one 100 Hz mag period
+		auto start = std::chrono::steady_clock::now();
+		mpu.update_mag();
+		ns += elapsed_ns(start);
+	}
+	sink = mpu.getMagX();
+	return bus_result("update_mag", "-", 0, n, ns, d);
+}
+
+Result bench_update_rpy(uint64_t n) {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	MPU mpu;
+	SimpleFilter filter;
+	mpu.setup(0x68, d, filter);
+
+	// precomputed orientations, so only the conversion is timed
+	std::vector<MotionSample> qs(1024);
+	for (size_t i = 0; i < qs.size(); ++i)
+		motion.sample(i * 50000, qs[i]);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		const float* q = qs[i & 1023].q;
+		mpu.update_rpy(q[0], q[1], q[2], q[3]);
+	}
+	double ns = elapsed_ns(start);
+	sink = mpu.getRoll();
+	return Result {"update_rpy", "-", 0, n, ns / n, 0., 0.};
+}
+
+// Filter::update() alone, on prerecorded sensor data, the 5 ms sample
+// period split over the iterations
+Result bench_filter(const char* name, Filter& filter, size_t iterations, uint64_t n) {
+	SyntheticMotion motion;
+	std::vector<MotionSample> in(1024);
+	for (size_t i = 0; i < in.size(); ++i)
+		motion.sample(i * 5000, in[i]);
+
+	const float deg2rad = 3.14159265358979f / 180.f;
+	const uint32_t step_us = 5000 / iterations;
+	uint32_t time_us = 0;
+	float q[4] {1.f, 0.f, 0.f, 0.f};
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t i = 0; i < n; ++i) {
+		const MotionSample& s = in[i & 1023];
+		// same axis mapping as MPU::update_filter()
+		for (size_t k = 0; k < iterations; ++k, time_us += step_us)
+			filter.update(-s.acc[0], s.acc[1], s.acc[2],
+			              s.gyro[0] * deg2rad, -s.gyro[1] * deg2rad, -s.gyro[2] * deg2rad,
+			              s.mag[1], -s.mag[0], s.mag[2], time_us, q);
+	}
+	double ns = elapsed_ns(start);
+	sink = q[0];
+	return Result {"filter", name, iterations, n, ns / n, 0., 0.};
+}
+
+// MadgwickBank / MahonyBank with N instances on prerecorded sensor data,
+// per instance update, to set against the filter rows at 1 iteration.
+// The samples start after the first, which matches the initial
+// orientation exactly and makes the Madgwick step NaN.
+template <typename BankT>
+void bench_bank(const char* name, uint64_t n, std::vector<Result>& results) {
+	const size_t n_inst = BankT().size();
+	SyntheticMotion motion;
+	std::vector<MotionSample> in(1024);
+	for (size_t i = 0; i < in.size(); ++i)
+		motion.sample(i * 5000, in[i]);
+
+	BankT bank;
+	const uint64_t n_steps = n / n_inst + 1;
+	auto start = std::chrono::steady_clock::now();
+	for (uint64_t k = 0; k < n_steps; ++k) {
+		for (size_t i = 0; i < n_inst; ++i) {
+			const MotionSample& s = in[(k + 37 * i + 1) & 1023];
+			bank.setSensor(i, s.acc, s.gyro, s.mag);
+		}
+		bank.update(0.005f);
+	}
+	double ns = elapsed_ns(start);
+	float q[4];
+	bank.getQuaternion(n_inst - 1, q);
+	sink = q[0];
+	results.push_back(Result {std::string("bank_") + bank_kernel(), name, n_inst, n_steps * n_inst, ns / (n_steps * n_inst), 0., 0.});
+}
+
+// decode_frames() on bursts of raw FIFO frames held in memory, per frame.
+// Both kernels decode in place like readFifoScaled().
+void bench_decode(uint64_t n, std::vector<Result>& results) {
+	const size_t burst = 36;  // 14 byte frames in the 512 byte FIFO
+	const size_t n_bursts = 64;
+	std::vector<uint8_t> raw(n_bursts * burst * 14);
+	uint32_t x = 1;
+	for (uint8_t& b : raw) {
+		x = x * 1664525u + 1013904223u;
+		b = (uint8_t)(x >> 24);
+	}
+	const float scale[DECODE_FRAME_WORDS] {1.f / 16384.f, 1.f / 16384.f, 1.f / 16384.f, 1.f / 333.87f,
+	                                       250.f / 32768.f, 250.f / 32768.f, 250.f / 32768.f};
+	const float offset[DECODE_FRAME_WORDS] {0.f, 0.f, 0.f, 21.f, 0.f, 0.f, 0.f};
+	typedef void (*Kernel)(const uint8_t*, size_t, const float*, const float*, float*);
+	struct { const char* name; Kernel kernel; } kernels[] {
+		{"scalar", decode_frames_scalar},
+		{decode_kernel(), decode_frames},
+	};
+
+	std::vector<float> out[2];
+	for (size_t k = 0; k < 2; ++k) {
+		out[k].resize(n_bursts * burst * DECODE_FRAME_WORDS);
+		const uint64_t n_runs = n / burst + 1;
+		double ns = 0.;
+		for (uint64_t i = 0; i < n_runs; ++i) {
+			const size_t b = i % n_bursts;
+			float* dest = &out[k][b * burst * DECODE_FRAME_WORDS];
+			uint8_t* packed = reinterpret_cast<uint8_t*>(dest) + burst * 14;
+			memcpy(packed, &raw[b * burst * 14], burst * 14);
+			auto start = std::chrono::steady_clock::now();
+			kernels[k].kernel(packed, burst, scale, offset, dest);
+			ns += elapsed_ns(start);
+		}
+		sink = out[k][0];
+		results.push_back(Result {"decode_frames", kernels[k].name, 0, n_runs * burst, ns / (n_runs * burst), 0., 0.});
+	}
+}
+
+// MPUArray::update() with n devices on one bus, per device sample
+Result bench_array(MPUArray::Schedule schedule, uint8_t n_devices, uint64_t n) {
+	SyntheticMotion motion[MPUArray::MAX_DEVICES];
+	std::vector<SimulatedDriver*> devices;
+	MadgwickFilter filters[MPUArray::MAX_DEVICES];
+	MPU mpus[MPUArray::MAX_DEVICES];
+	SimulatedBus bus;
+	MPUArray array;
+	array.schedule(schedule);
+	Setting setting;
+	setting.mag_via_i2c_master = true;
+	for (uint8_t i = 0; i < n_devices; ++i) {
+		devices.push_back(new SimulatedDriver(motion[i], 0x68 + i));
+		configure_errors(*devices.back());
+		bus.attach(*devices.back());
+	}
+	for (uint8_t i = 0; i < n_devices; ++i) {
+		mpus[i].setup(0x68 + i, bus, filters[i], setting);
+		array.add(mpus[i]);
+	}
+
+	bus.resetStats();
+	uint64_t samples = 0;
+	double ns = 0.;
+	while (samples < n) {
+		bus.advance(5000);
+		auto start = std::chrono::steady_clock::now();
+		uint8_t updated = array.update();
+		ns += elapsed_ns(start);
+		for (uint8_t i = 0; i < n_devices; ++i)
+			samples += (updated >> i) & 1;
+	}
+	const SimulatedDriver::Stats s = bus.stats();
+	for (SimulatedDriver* d : devices)
+		delete d;
+
+	double bytes = (double)(s.bytes_read + s.bytes_written);
+	double bus_us = (double)(s.transactions + bytes) * 9. * 1e6 / 400000.;
+	const char* name = (schedule == MPUArray::Schedule::ALIGNED) ? "array_aligned" : "array_round_robin";
+	return Result {name, "madgwick", n_devices, samples, ns / samples, bytes / samples, bus_us / samples};
+}
+
+// Overlap of bus and CPU: the bus takes real time (ThreadedBus) and the
+// loop does app_us of other work per iteration. Reports the wall time per
+// sample and the time spent inside update()/updateAsync() per sample.
+// The overlap itself is checked by the async_overlap test.
+void bench_threaded(bool async, uint64_t n, std::vector<Result>& results) {
+	const uint64_t app_us = 400;
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	configure_errors(d);
+	ThreadedBus bus(d);
+	MadgwickFilter filter;
+	AsyncMPU mpu;
+	Setting setting;
+	setting.mag_via_i2c_master = true;
+	setting.fifo_sample_rate = FIFO_SAMPLE_RATE::SMPL_1000HZ;
+	mpu.setup(0x68, bus, filter, setting);
+	mpu.setFilterIterations(10);
+
+	d.resetStats();
+	uint64_t samples = 0;
+	double call_ns = 0.;
+	auto wall = std::chrono::steady_clock::now();
+	while (samples < n) {
+		auto start = std::chrono::steady_clock::now();
+		if (async ? mpu.updateAsync() : mpu.update())
+			++samples;
+		call_ns += elapsed_ns(start);
+
+		// other work of the application, in real and in device time
+		auto work = std::chrono::steady_clock::now();
+		while (elapsed_ns(work) < app_us * 1000.)
+			sink = sink + 1.f;
+		bus.advance(app_us);
+	}
+	double wall_ns = elapsed_ns(wall);
+	while (!bus.transfer_done()) {}
+
+	const char* name = async ? "threaded_async" : "threaded_sync";
+	Result r = bus_result(name, "madgwick", 10, samples, wall_ns, d);
+	results.push_back(r);
+	r.bench += "_in_call";
+	r.ns_per_sample = call_ns / samples;
+	results.push_back(r);
+}
+
+// SPSCQueue under load: update() pushes FIFO samples from one thread,
+// with produce_us of other work per frame, and a second thread pops them
+// and sleeps for stall_us every stall_every samples. Reports the producer
+// wall time per sample, iterations holds the queue capacity.
+void bench_queue(uint16_t capacity, uint32_t stall_every, uint32_t stall_us,
+                 uint64_t n, std::vector<Result>& results) {
+	const uint32_t produce_us = 5;
+	const uint32_t period_us = 1000;
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	configure_errors(d);
+	MadgwickFilter filter;
+	MPU mpu;
+	Setting setting;
+	setting.mag_via_i2c_master = true;
+	setting.fifo_sample_rate = FIFO_SAMPLE_RATE::SMPL_1000HZ;
+	mpu.setup(0x68, d, filter, setting);
+	mpu.enableFifo();
+	std::vector<Sample> storage(capacity + 1);
+	SPSCQueue<Sample> queue(storage.data(), capacity + 1);
+	mpu.attachQueue(&queue);
+
+	std::atomic<bool> started {false}, done {false};
+	uint64_t popped = 0;
+	std::thread consumer([&] {
+		Sample s;
+		started.store(true, std::memory_order_release);
+		for (;;) {
+			bool finished = done.load(std::memory_order_acquire);
+			if (!queue.pop(s)) {
+				if (finished)
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			// descheduled, as by a higher priority task
+			if (++popped % stall_every == 0)
+				std::this_thread::sleep_for(std::chrono::microseconds(stall_us));
+		}
+	});
+	while (!started.load(std::memory_order_acquire)) {}
+
+	// every frame the device produces from here on goes through the FIFO
+	const uint64_t first = d.samples();
+	auto wall = std::chrono::steady_clock::now();
+	while (d.samples() - first < n) {
+		mpu.update();
+		d.advance(2 * period_us);
+		auto work = std::chrono::steady_clock::now();
+		while (elapsed_ns(work) < 2 * produce_us * 1000.)
+			sink = sink + 1.f;
+		// lets the consumer run on a single core too
+		std::this_thread::yield();
+	}
+	while (mpu.update()) {}
+	double wall_ns = elapsed_ns(wall);
+	done.store(true, std::memory_order_release);
+	consumer.join();
+
+	const uint64_t pushed = d.samples() - first;
+	const uint64_t overflows = queue.overflows();
+	std::string name = "queue_spsc_stall" + std::to_string(stall_us) + "us_overflow" + std::to_string(overflows);
+	results.push_back(Result {name, "madgwick", capacity, pushed, wall_ns / pushed, 0., 0.});
+}
+
+void print_csv(FILE* fp, const std::vector<Result>& results) {
+	fprintf(fp, "bench,filter,iterations,samples,ns_per_sample,bytes_per_sample,bus_us_per_sample\n");
+	for (const Result& r : results)
+		fprintf(fp, "%s,%s,%zu,%llu,%.1f,%.2f,%.1f\n", r.bench.c_str(), r.filter.c_str(),
+		        r.iterations, (unsigned long long)r.samples, r.ns_per_sample,
+		        r.bytes_per_sample, r.bus_us_per_sample);
+}
+
+void print_json(FILE* fp, const std::vector<Result>& results) {
+	fprintf(fp, "[\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& r = results[i];
+		fprintf(fp, "  {\"bench\": \"%s\", \"filter\": \"%s\", \"iterations\": %zu, \"samples\": %llu, "
+		            "\"ns_per_sample\": %.1f, \"bytes_per_sample\": %.2f, \"bus_us_per_sample\": %.1f}%s\n",
+		        r.bench.c_str(), r.filter.c_str(), r.iterations, (unsigned long long)r.samples,
+		        r.ns_per_sample, r.bytes_per_sample, r.bus_us_per_sample,
+		        (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(fp, "]\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	bool json = false;
+	uint64_t n = 100000;
+	const char* out_path = nullptr;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--json"))
+			json = true;
+		else if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+			n = strtoull(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			out_path = argv[++i];
+		else {
+			fprintf(stderr, "usage: %s [--json] [--samples N] [-o file]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	SimpleFilter simple;
+	MadgwickFilter madgwick;
+	MadgwickFilterFloat madgwick_float;
+	MahonyFilter mahony;
+	FixedSimpleFilter fixed_simple;
+	FixedMadgwickFilter fixed_madgwick;
+	FixedMahonyFilter fixed_mahony;
+	// the fixed point filters through the float update_impl(), with conversion
+	struct { const char* name; Filter* filter; } filters[] {
+		{"simple", &simple},
+		{"madgwick", &madgwick},
+		{"madgwick_float", &madgwick_float},
+		{"mahony", &mahony},
+		{"fixed_simple", &fixed_simple},
+		{"fixed_madgwick", &fixed_madgwick},
+		{"fixed_mahony", &fixed_mahony},
+	};
+	const size_t iterations[] {1, 10, 20};
+
+	std::vector<Result> results;
+	results.push_back(bench_update_accel_gyro(n));
+	results.push_back(bench_update_mag(n));
+	results.push_back(bench_update_rpy(n * 10));
+	for (auto& f : filters)
+		for (size_t it : iterations)
+			results.push_back(bench_filter(f.name, *f.filter, it, n));
+	for (auto& f : filters)
+		for (size_t it : iterations)
+			results.push_back(bench_update(f.name, *f.filter, it, false, n / 10));
+	for (auto& f : filters)
+		results.push_back(bench_update(f.name, *f.filter, 10, true, n / 10));
+	// one predict and update per sample, compare with madgwick at 10 iterations
+	EskfFilter eskf;
+	results.push_back(bench_filter("eskf", eskf, 1, n));
+	results.push_back(bench_update("eskf", eskf, 1, false, n / 10));
+	// and from the raw counts
+	results.push_back(bench_update("fixed_simple_counts", fixed_simple, 10, false, n / 10));
+	results.push_back(bench_update("fixed_madgwick_counts", fixed_madgwick, 10, false, n / 10));
+	results.push_back(bench_update("fixed_mahony_counts", fixed_mahony, 10, false, n / 10));
+	// the iterations column holds the number of devices
+	for (uint8_t d = 1; d <= 4; ++d) {
+		results.push_back(bench_array(MPUArray::Schedule::ROUND_ROBIN, d, n / 10));
+		results.push_back(bench_array(MPUArray::Schedule::ALIGNED, d, n / 10));
+	}
+
+	bench_decode(n * 10, results);
+	// the iterations column holds the number of instances
+	bench_bank<MadgwickBank<1>>("madgwick", n, results);
+	bench_bank<MadgwickBank<4>>("madgwick", n, results);
+	bench_bank<MadgwickBank<16>>("madgwick", n, results);
+	bench_bank<MadgwickBank<64>>("madgwick", n, results);
+	bench_bank<MahonyBank<1>>("mahony", n, results);
+	bench_bank<MahonyBank<4>>("mahony", n, results);
+	bench_bank<MahonyBank<16>>("mahony", n, results);
+	bench_bank<MahonyBank<64>>("mahony", n, results);
+
+	bench_threaded(false, n / 100, results);
+	bench_threaded(true, n / 100, results);
+	bench_queue(256, 1000, 10, n / 10, results);
+	bench_queue(16, 50, 200, n / 10, results);
+
+	FILE* fp = out_path ? fopen(out_path, "w") : stdout;
+	if (!fp) {
+		perror(out_path);
+		return 1;
+	}
+	if (json)
+		print_json(fp, results);
+	else
+		print_csv(fp, results);
+	if (out_path)
+		fclose(fp);
+	return 0;
+}
@@ -0,0 +1,39 @@
+#include "LinuxDriver.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace MPU9250 {
+
+LinuxDriver::LinuxDriver(const char* device) {
+	fd = ::open(device, O_RDWR | O_CLOEXEC);
+	check(fd);
+}
+
+LinuxDriver::~LinuxDriver() {
+	if (fd >= 0)
+		::close(fd);
+}
+
+bool LinuxDriver::check(int result) {
+	if (result >= 0)
+		return true;
+	error = errno;
+	return false;
+}
+
+void LinuxDriver::delay(uint32_t milli_seconds) {
+	timespec ts;
+	ts.tv_sec = milli_seconds / 1000;
+	ts.tv_nsec = (long)(milli_seconds % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+}
+
+uint32_t LinuxDriver::micros() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL);
+}
+
+} // namespace MPU9250
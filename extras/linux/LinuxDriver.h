@@ -0,0 +1,38 @@
+#ifndef MPU9250_LINUXDRIVER_H
+#define MPU9250_LINUXDRIVER_H
+#include "MPU9250.h"
+
+namespace MPU9250 {
+
+// Common part of the Linux drivers: owns the device file descriptor and
+// provides delay() and a CLOCK_MONOTONIC micros(). Driver methods have no
+// way to report failure, so a failed transfer reads zeros (which fails the
+// WHO_AM_I checks in setup()) and leaves its errno in lastError().
+class LinuxDriver : public Driver {
+public:
+	LinuxDriver(const LinuxDriver&) = delete;
+	LinuxDriver& operator=(const LinuxDriver&) = delete;
+	virtual ~LinuxDriver();
+
+	bool isOpen() const { return fd >= 0; }
+	// errno of the last failed open or transfer, 0 if none failed
+	int lastError() const { return error; }
+	void clearError() { error = 0; }
+
+	virtual void delay(uint32_t milli_seconds) override;
+	virtual bool has_clock() override { return true; }
+	virtual uint32_t micros() override;
+
+protected:
+	explicit LinuxDriver(const char* device);
+
+	int fd {-1};
+	int error {0};
+
+	// record errno when result < 0, returns whether the call succeeded
+	bool check(int result);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_LINUXDRIVER_H
@@ -0,0 +1,152 @@
+#include "LinuxI2CDriver.h"
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+
+namespace MPU9250 {
+
+namespace {
+
+std::string bus_path(int bus) {
+	return "/dev/i2c-" + std::to_string(bus);
+}
+
+} // namespace
+
+LinuxI2CDriver::LinuxI2CDriver(int bus) : LinuxI2CDriver(bus_path(bus).c_str()) {
+}
+
+LinuxI2CDriver::LinuxI2CDriver(const char* device) : LinuxDriver(device) {
+	init();
+}
+
+void LinuxI2CDriver::init() {
+	if (fd < 0)
+		return;
+	if (check(ioctl(fd, I2C_FUNCS, &funcs)))
+		plain_i2c = (funcs & I2C_FUNC_I2C) != 0;
+}
+
+bool LinuxI2CDriver::transfer(i2c_msg* msgs, int count) {
+	i2c_rdwr_ioctl_data rdwr;
+	rdwr.msgs = msgs;
+	rdwr.nmsgs = count;
+	return check(ioctl(fd, I2C_RDWR, &rdwr));
+}
+
+void LinuxI2CDriver::write(uint8_t address, const uint8_t* data, int length) {
+	if (!plain_i2c) {
+		smbus_write(address, data, length);
+		return;
+	}
+	i2c_msg msg {address, 0, (uint16_t)length, const_cast<uint8_t*>(data)};
+	transfer(&msg, 1);
+}
+
+void LinuxI2CDriver::read(uint8_t address, uint8_t* data, int length) {
+	bool ok;
+	if (plain_i2c) {
+		i2c_msg msg {address, I2C_M_RD, (uint16_t)length, data};
+		ok = transfer(&msg, 1);
+	} else {
+		ok = smbus_read(address, data, length);
+	}
+	if (!ok)
+		memset(data, 0, length);
+}
+
+void LinuxI2CDriver::write_read(uint8_t address, const uint8_t* wdata, int wlength, uint8_t* rdata, int rlength) {
+	bool ok;
+	if (plain_i2c) {
+		i2c_msg msgs[2] {
+			{address, 0, (uint16_t)wlength, const_cast<uint8_t*>(wdata)},
+			{address, I2C_M_RD, (uint16_t)rlength, rdata},
+		};
+		ok = transfer(msgs, 2);
+	} else if (wlength == 1) {
+		ok = smbus_read_reg(address, wdata[0], rdata, rlength);
+	} else {
+		ok = smbus_write(address, wdata, wlength) && smbus_read(address, rdata, rlength);
+	}
+	if (!ok)
+		memset(rdata, 0, rlength);
+}
+
+bool LinuxI2CDriver::smbus(uint8_t address, char read_write, uint8_t command, int size, void* data) {
+	if (fd < 0)
+		return false;
+	if (address != slave_address) {
+		if (!check(ioctl(fd, I2C_SLAVE, (unsigned long)address)))
+			return false;
+		slave_address = address;
+	}
+	i2c_smbus_ioctl_data args;
+	args.read_write = read_write;
+	args.command = command;
+	args.size = size;
+	args.data = (i2c_smbus_data*)data;
+	return check(ioctl(fd, I2C_SMBUS, &args));
+}
+
+bool LinuxI2CDriver::smbus_write(uint8_t address, const uint8_t* data, int length) {
+	if (length <= 0)
+		return true;
+	// a lone register byte only sets the register pointer
+	if (length == 1)
+		return smbus(address, I2C_SMBUS_WRITE, data[0], I2C_SMBUS_BYTE, nullptr);
+
+	i2c_smbus_data d;
+	if (length == 2 || !(funcs & I2C_FUNC_SMBUS_WRITE_I2C_BLOCK)) {
+		for (int i = 1; i < length; ++i) {
+			d.byte = data[i];
+			if (!smbus(address, I2C_SMBUS_WRITE, data[0] + i - 1, I2C_SMBUS_BYTE_DATA, &d))
+				return false;
+		}
+		return true;
+	}
+	for (int i = 1; i < length; i += I2C_SMBUS_BLOCK_MAX) {
+		int n = length - i < I2C_SMBUS_BLOCK_MAX ? length - i : I2C_SMBUS_BLOCK_MAX;
+		d.block[0] = n;
+		memcpy(d.block + 1, data + i, n);
+		if (!smbus(address, I2C_SMBUS_WRITE, data[0] + i - 1, I2C_SMBUS_I2C_BLOCK_DATA, &d))
+			return false;
+	}
+	return true;
+}
+
+bool LinuxI2CDriver::smbus_read(uint8_t address, uint8_t* data, int length) {
+	// receive byte, from the register pointer on, which the device increments
+	i2c_smbus_data d;
+	for (int i = 0; i < length; ++i) {
+		if (!smbus(address, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &d))
+			return false;
+		data[i] = d.byte;
+	}
+	return true;
+}
+
+bool LinuxI2CDriver::smbus_read_reg(uint8_t address, uint8_t reg, uint8_t* data, int length) {
+	// FIFO_R_W does not increment, every chunk reads the FIFO again
+	const bool advance = reg != FIFO_R_W;
+	i2c_smbus_data d;
+	if (!(funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK)) {
+		for (int i = 0; i < length; ++i) {
+			if (!smbus(address, I2C_SMBUS_READ, advance ? reg + i : reg, I2C_SMBUS_BYTE_DATA, &d))
+				return false;
+			data[i] = d.byte;
+		}
+		return true;
+	}
+	for (int i = 0; i < length; i += I2C_SMBUS_BLOCK_MAX) {
+		int n = length - i < I2C_SMBUS_BLOCK_MAX ? length - i : I2C_SMBUS_BLOCK_MAX;
+		d.block[0] = n;
+		if (!smbus(address, I2C_SMBUS_READ, advance ? reg + i : reg, I2C_SMBUS_I2C_BLOCK_DATA, &d))
+			return false;
+		memcpy(data + i, d.block + 1, n);
+	}
+	return true;
+}
+
+} // namespace MPU9250
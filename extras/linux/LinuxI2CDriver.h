@@ -0,0 +1,41 @@
+#ifndef MPU9250_LINUXI2CDRIVER_H
+#define MPU9250_LINUXI2CDRIVER_H
+#include "LinuxDriver.h"
+
+struct i2c_msg;
+
+namespace MPU9250 {
+
+// Driver for a Linux i2c-dev adapter (/dev/i2c-N). On an adapter that does
+// plain I2C every register read is one I2C_RDWR ioctl with two messages,
+// i.e. a single transfer with a repeated start between the register write
+// and the read. SMBus only adapters, such as the i2c-stub test module, get
+// the equivalent SMBus transfers instead (I2C block reads of up to 32 bytes).
+class LinuxI2CDriver final : public LinuxDriver {
+public:
+	explicit LinuxI2CDriver(int bus);               // /dev/i2c-<bus>
+	explicit LinuxI2CDriver(const char* device);
+
+	// true if transfers go through I2C_RDWR, false if through SMBus
+	bool isPlainI2C() const { return plain_i2c; }
+
+	virtual void write(uint8_t address, const uint8_t* data, int length) override;
+	virtual void read(uint8_t address, uint8_t* data, int length) override;
+	virtual void write_read(uint8_t address, const uint8_t* wdata, int wlength, uint8_t* rdata, int rlength) override;
+
+private:
+	unsigned long funcs {0};  // I2C_FUNC_* of the adapter
+	bool plain_i2c {false};
+	int slave_address {-1};   // set by I2C_SLAVE for the SMBus transfers
+
+	void init();
+	bool transfer(i2c_msg* msgs, int count);
+	bool smbus(uint8_t address, char read_write, uint8_t command, int size, void* data);
+	bool smbus_write(uint8_t address, const uint8_t* data, int length);
+	bool smbus_read(uint8_t address, uint8_t* data, int length);
+	bool smbus_read_reg(uint8_t address, uint8_t reg, uint8_t* data, int length);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_LINUXI2CDRIVER_H
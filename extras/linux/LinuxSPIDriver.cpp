@@ -0,0 +1,88 @@
+#include "LinuxSPIDriver.h"
+#include <errno.h>
+#include <linux/spi/spidev.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+namespace MPU9250 {
+
+namespace {
+
+constexpr uint8_t SPI_READ {0x80};
+
+bool is_fast_read(uint8_t reg, int length) {
+	return reg >= INT_STATUS && reg + length - 1 <= EXT_SENS_DATA_23;
+}
+
+} // namespace
+
+LinuxSPIDriver::LinuxSPIDriver(const char* device, uint32_t write_hz, uint32_t read_hz, uint8_t mpu_address)
+: LinuxDriver(device), write_hz(write_hz), read_hz(read_hz), mpu_address(mpu_address) {
+	if (fd < 0)
+		return;
+	// mode 3 and mode 0 both work, 3 idles the clock high like the datasheet timing
+	uint8_t mode = SPI_MODE_3;
+	uint8_t bits = 8;
+	if (!check(ioctl(fd, SPI_IOC_WR_MODE, &mode)) || !check(ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits)))
+		return;
+	uint32_t hz = read_hz;
+	check(ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz));
+}
+
+bool LinuxSPIDriver::accept(uint8_t address) {
+	if (address == mpu_address && fd >= 0)
+		return true;
+	error = (fd < 0) ? EBADF : ENXIO;
+	return false;
+}
+
+bool LinuxSPIDriver::transfer(int length, uint32_t hz) {
+	spi_ioc_transfer xfer;
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.tx_buf = (unsigned long)tx;
+	xfer.rx_buf = (unsigned long)rx;
+	xfer.len = length;
+	xfer.speed_hz = hz;
+	xfer.bits_per_word = 8;
+	return check(ioctl(fd, SPI_IOC_MESSAGE(1), &xfer));
+}
+
+void LinuxSPIDriver::write(uint8_t address, const uint8_t* data, int length) {
+	if (length <= 0 || length > MAX_TRANSFER || !accept(address))
+		return;
+	// a lone register byte is the register pointer of an I2C read
+	if (length == 1) {
+		last_reg = data[0];
+		return;
+	}
+	memcpy(tx, data, length);
+	tx[0] &= ~SPI_READ;
+	if (tx[0] == USER_CTRL)
+		tx[1] |= USER_CTRL_I2C_IF_DIS;
+	transfer(length, write_hz);
+}
+
+void LinuxSPIDriver::read(uint8_t address, uint8_t* data, int length) {
+	if (!read_reg(address, last_reg, data, length))
+		memset(data, 0, length);
+}
+
+void LinuxSPIDriver::write_read(uint8_t address, const uint8_t* wdata, int wlength, uint8_t* rdata, int rlength) {
+	if (wlength != 1)
+		Driver::write_read(address, wdata, wlength, rdata, rlength);
+	else if (!read_reg(address, wdata[0], rdata, rlength))
+		memset(rdata, 0, rlength);
+}
+
+bool LinuxSPIDriver::read_reg(uint8_t address, uint8_t reg, uint8_t* data, int length) {
+	if (length <= 0 || length + 1 > MAX_TRANSFER || !accept(address))
+		return false;
+	tx[0] = reg | SPI_READ;
+	memset(tx + 1, 0, length);
+	if (!transfer(length + 1, is_fast_read(reg, length) ? read_hz : write_hz))
+		return false;
+	memcpy(data, rx + 1, length);
+	return true;
+}
+
+} // namespace MPU9250
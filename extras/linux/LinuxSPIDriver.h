@@ -0,0 +1,43 @@
+#ifndef MPU9250_LINUXSPIDRIVER_H
+#define MPU9250_LINUXSPIDRIVER_H
+#include "LinuxDriver.h"
+
+namespace MPU9250 {
+
+// Driver for the MPU9250 on a Linux spidev device (/dev/spidevB.C).
+// The chip allows 1 MHz for all registers but 20 MHz for reading the sensor
+// and interrupt registers (INT_STATUS .. EXT_SENS_DATA_23), so those reads
+// run at read_hz and everything else at write_hz. A register read is one
+// full duplex transfer with the read bit set in the register byte.
+//
+// SPI reaches the MPU only: in bypass mode the AK8963 sits on the auxiliary
+// I2C pins, so set Setting::mag_via_i2c_master. Transfers to any other
+// address than mpu_address fail with ENXIO. Writes of USER_CTRL keep
+// I2C_IF_DIS set, which the reset in setup() would clear.
+class LinuxSPIDriver final : public LinuxDriver {
+public:
+	explicit LinuxSPIDriver(const char* device, uint32_t write_hz = 1000000, uint32_t read_hz = 20000000,
+	                        uint8_t mpu_address = 0x68);
+
+	virtual void write(uint8_t address, const uint8_t* data, int length) override;
+	virtual void read(uint8_t address, uint8_t* data, int length) override;
+	virtual void write_read(uint8_t address, const uint8_t* wdata, int wlength, uint8_t* rdata, int rlength) override;
+
+private:
+	static constexpr int MAX_TRANSFER {1 + 512};  // register + the whole FIFO
+
+	const uint32_t write_hz;
+	const uint32_t read_hz;
+	const uint8_t mpu_address;
+	uint8_t last_reg {0};  // register of the last lone register write, for read()
+	uint8_t tx[MAX_TRANSFER];
+	uint8_t rx[MAX_TRANSFER];
+
+	bool transfer(int length, uint32_t hz);
+	bool accept(uint8_t address);
+	bool read_reg(uint8_t address, uint8_t reg, uint8_t* data, int length);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_LINUXSPIDRIVER_H
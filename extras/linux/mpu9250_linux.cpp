@@ -0,0 +1,122 @@
+// MPU9250 on a Linux host through i2c-dev or spidev.
+//
+//   mpu9250_linux i2c <bus> [address] [--probe]
+//   mpu9250_linux spi <device>        [--probe]
+//
+// Without --probe it sets the device up and prints yaw, pitch and roll at
+// 10 Hz. --probe only checks the transport: WHO_AM_I, and a block of
+// registers read as one combined transfer and as separate write and read,
+// which have to agree. It needs no real sensor, see README (i2c-stub).
+
+#include "LinuxI2CDriver.h"
+#include "LinuxSPIDriver.h"
+#include <MPU9250.h>
+#include <QuaternionFilter.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MPU9250;
+
+namespace {
+
+int usage() {
+	fprintf(stderr,
+		"usage: mpu9250_linux i2c <bus> [address] [--probe]\n"
+		"       mpu9250_linux spi <device> [--probe]\n");
+	return 2;
+}
+
+int probe(LinuxDriver& driver, uint8_t address) {
+	uint8_t reg = WHO_AM_I_MPU9250;
+	uint8_t who = 0;
+	driver.write_read(address, &reg, 1, &who, 1);
+	printf("WHO_AM_I      : 0x%02X\n", who);
+
+	// the self test registers hold factory values, they do not change
+	const int n = SELF_TEST_Z_ACCEL - SELF_TEST_X_GYRO + 1;
+	uint8_t combined[n], split[n];
+	reg = SELF_TEST_X_GYRO;
+	driver.write_read(address, &reg, 1, combined, n);
+	driver.write(address, &reg, 1);
+	driver.read(address, split, n);
+	printf("self test regs:");
+	for (int i = 0; i < n; ++i)
+		printf(" %02X", combined[i]);
+	printf("\n");
+
+	if (driver.lastError()) {
+		fprintf(stderr, "transfer failed: %s\n", strerror(driver.lastError()));
+		return 1;
+	}
+	if (memcmp(combined, split, n) != 0) {
+		fprintf(stderr, "combined and separate reads differ\n");
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
+
+int run(LinuxDriver& driver, uint8_t address, const Setting& setting) {
+	static MPU mpu;
+	MadgwickFilter filter;
+	Error e = mpu.setup(address, driver, filter, setting);
+	if (e != Error::NONE) {
+		fprintf(stderr, "setup failed (%d)%s%s\n", (int)e,
+			driver.lastError() ? ": " : "", driver.lastError() ? strerror(driver.lastError()) : "");
+		return 1;
+	}
+	uint32_t last = driver.micros();
+	for (;;) {
+		if (mpu.update() && driver.micros() - last >= 100000) {
+			last = driver.micros();
+			printf("%8.2f %8.2f %8.2f\n", mpu.getYaw(), mpu.getPitch(), mpu.getRoll());
+			fflush(stdout);
+		}
+		driver.delay(1);
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	bool only_probe = false;
+	int n_args = 0;
+	const char* args[3] {};
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--probe"))
+			only_probe = true;
+		else if (n_args < 3)
+			args[n_args++] = argv[i];
+		else
+			return usage();
+	}
+	if (n_args < 2)
+		return usage();
+
+	uint8_t address = 0x68;
+	Setting setting;
+	LinuxDriver* driver = nullptr;
+	if (!strcmp(args[0], "i2c")) {
+		if (n_args > 2)
+			address = (uint8_t)strtoul(args[2], nullptr, 0);
+		LinuxI2CDriver* i2c = new LinuxI2CDriver(atoi(args[1]));
+		if (i2c->isOpen())
+			printf("transfers     : %s\n", i2c->isPlainI2C() ? "I2C_RDWR" : "SMBus");
+		driver = i2c;
+	} else if (!strcmp(args[0], "spi") && n_args == 2) {
+		driver = new LinuxSPIDriver(args[1], 1000000, 20000000, address);
+		setting.mag_via_i2c_master = true;  // SPI does not reach the AK8963
+	} else {
+		return usage();
+	}
+	if (!driver->isOpen()) {
+		fprintf(stderr, "%s: %s\n", args[1], strerror(driver->lastError()));
+		delete driver;
+		return 1;
+	}
+
+	int result = only_probe ? probe(*driver, address) : run(*driver, address, setting);
+	delete driver;
+	return result;
+}
@@ -0,0 +1,575 @@
+#include "SimulatedDriver.h"
+#include <AK8963RegisterMap.h>
+#include <MPU9250RegisterMap.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace MPU9250 {
+
+namespace {
+
+constexpr double sim_pi = 3.14159265358979323846;
+
+// v_body = R(q)^T v_earth, q rotates body to earth (w, x, y, z)
+void rotate_to_body(const double* q, const double* v, double* out) {
+	double w = q[0], x = q[1], y = q[2], z = q[3];
+	out[0] = (1 - 2 * (y * y + z * z)) * v[0] + 2 * (x * y + w * z) * v[1] + 2 * (x * z - w * y) * v[2];
+	out[1] = 2 * (x * y - w * z) * v[0] + (1 - 2 * (x * x + z * z)) * v[1] + 2 * (y * z + w * x) * v[2];
+	out[2] = 2 * (x * z + w * y) * v[0] + 2 * (y * z - w * x) * v[1] + (1 - 2 * (x * x + y * y)) * v[2];
+}
+
+int16_t saturate(double v) {
+	if (v > 32767.) return 32767;
+	if (v < -32768.) return -32768;
+	return (int16_t)lround(v);
+}
+
+} // namespace
+
+///////////////////////////////
+// Motion sources
+///////////////////////////////
+
+void SyntheticMotion::rate_at(double t, double* w) const {
+	for (int i = 0; i < 3; ++i)
+		w[i] = rate_amplitude[i] * sim_pi / 180. * sin(2. * sim_pi * rate_frequency[i] * t + i);
+}
+
+void SyntheticMotion::sample(uint64_t time_us, MotionSample& s) {
+	if (!started) {
+		started = true;
+		last_time_us = time_us;
+	}
+
+	// integrate q' = 0.5 * q x w in steps of at most 1 ms
+	while (last_time_us < time_us) {
+		uint64_t step_us = time_us - last_time_us;
+		if (step_us > 1000)
+			step_us = 1000;
+		double dt = step_us * 1e-6;
+		double w[3];
+		rate_at((last_time_us + step_us / 2) * 1e-6, w);
+		double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * dt;
+		double c = cos(angle / 2.);
+		double k = (angle > 0.) ? sin(angle / 2.) / angle * dt : 0.;
+		double r[4] = {c, w[0] * k, w[1] * k, w[2] * k};
+		double n[4] = {
+			q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3],
+			q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2],
+			q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1],
+			q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0],
+		};
+		double norm = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2] + n[3] * n[3]);
+		for (int i = 0; i < 4; ++i)
+			q[i] = n[i] / norm;
+		last_time_us += step_us;
+	}
+
+	// filter frame (X-forward, Z-down) vectors in the body
+	const double gravity[3] = {0., 0., 1.};
+	const double incl = field_inclination * sim_pi / 180.;
+	const double field[3] = {field_strength * cos(incl), 0., field_strength * sin(incl)};
+	double acc_f[3], mag_f[3], w[3];
+	rotate_to_body(q, gravity, acc_f);
+	rotate_to_body(q, field, mag_f);
+	rate_at(time_us * 1e-6, w);
+
+	// inverse of the axis mapping in MPU::update_filter()
+	s.acc[0] = -acc_f[0];
+	s.acc[1] = +acc_f[1];
+	s.acc[2] = +acc_f[2];
+	s.gyro[0] = +w[0] * 180. / sim_pi;
+	s.gyro[1] = -w[1] * 180. / sim_pi;
+	s.gyro[2] = -w[2] * 180. / sim_pi;
+	s.mag[0] = -mag_f[1];
+	s.mag[1] = +mag_f[0];
+	s.mag[2] = +mag_f[2];
+	for (int i = 0; i < 4; ++i)
+		s.q[i] = q[i];
+}
+
+bool TraceMotion::load(const char* path) {
+	FILE* fp = fopen(path, "r");
+	if (!fp)
+		return false;
+	records.clear();
+	index = 0;
+	char line[512];
+	while (fgets(line, sizeof(line), fp)) {
+		Record r {};
+		unsigned long long t = 0;
+		int n = sscanf(line, "%llu,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f", &t,
+		               &r.s.acc[0], &r.s.acc[1], &r.s.acc[2],
+		               &r.s.gyro[0], &r.s.gyro[1], &r.s.gyro[2],
+		               &r.s.mag[0], &r.s.mag[1], &r.s.mag[2],
+		               &r.s.q[0], &r.s.q[1], &r.s.q[2], &r.s.q[3]);
+		if (n < 10)
+			continue;  // header or comment
+		if (n < 14) {
+			r.s.q[0] = 1.f;
+			r.s.q[1] = r.s.q[2] = r.s.q[3] = 0.f;
+		}
+		r.time_us = t;
+		records.push_back(r);
+	}
+	fclose(fp);
+	return !records.empty();
+}
+
+void TraceMotion::sample(uint64_t time_us, MotionSample& s) {
+	if (records.empty()) {
+		s = MotionSample {};
+		s.q[0] = 1.f;
+		return;
+	}
+	while (index + 1 < records.size() && records[index + 1].time_us <= time_us)
+		++index;
+	s = records[index].s;
+}
+
+///////////////////////////////
+// Simulated device
+///////////////////////////////
+
+SimulatedDriver::SimulatedDriver(MotionSource& motion, uint8_t mpu_address)
+: motion(motion), mpu_address(mpu_address) {
+	reset_mpu();
+	reset_mag();
+}
+
+void SimulatedDriver::reset_mpu() {
+	memset(mpu_regs, 0, sizeof(mpu_regs));
+	mpu_regs[WHO_AM_I_MPU9250] = MPU9250_WHOAMI_DEFAULT_VALUE;
+	mpu_regs[PWR_MGMT_1] = 0x01;
+	fifo.clear();
+	int_pending = false;
+}
+
+void SimulatedDriver::reset_mag() {
+	memset(mag_regs, 0, sizeof(mag_regs));
+	mag_regs[AK8963_WHO_AM_I] = AK8963_WHOAMI_DEFAULT_VALUE;
+}
+
+bool SimulatedDriver::mag_reachable() const {
+	return (mpu_regs[INT_PIN_CFG] & INT_PIN_CFG_BYPASS_EN) &&
+	      !(mpu_regs[USER_CTRL] & USER_CTRL_I2C_MST_EN);
+}
+
+void SimulatedDriver::bus_time(int length) {
+	// address byte + data bytes, 9 clocks each (8 bits + ack)
+	uint64_t ns = (uint64_t)(length + 1) * 9 * 1000000000ULL / bus_hz;
+	advance_to_ns(now_ns + ns);
+}
+
+void SimulatedDriver::write(uint8_t address, const uint8_t* data, int length) {
+	++bus_stats.transactions;
+	bus_stats.bytes_written += length;
+	bus_time(length);
+	if (length < 1)
+		return;
+
+	if (address == mpu_address) {
+		mpu_ptr = data[0] & 0x7F;
+		for (int i = 1; i < length; ++i) {
+			mpu_write(mpu_ptr, data[i]);
+			if (mpu_ptr != FIFO_R_W)
+				mpu_ptr = (mpu_ptr + 1) & 0x7F;
+		}
+	} else if (address == AK8963_ADDRESS && mag_reachable()) {
+		mag_ptr = data[0] & 0x1F;
+		for (int i = 1; i < length; ++i)
+			mag_write(mag_ptr++ & 0x1F, data[i]);
+	} else {
+		++bus_stats.nacks;
+	}
+}
+
+void SimulatedDriver::read(uint8_t address, uint8_t* data, int length) {
+	++bus_stats.transactions;
+	bus_stats.bytes_read += length;
+
+	if (address == mpu_address && mpu_ptr == FIFO_R_W) {
+		// the clock runs byte by byte, so that a long burst drains the FIFO
+		// while new frames come in, as the device does
+		const uint64_t start_ns = now_ns;
+		for (int i = 0; i < length; ++i) {
+			advance_to_ns(start_ns + (uint64_t)(i + 2) * 9 * 1000000000ULL / bus_hz);
+			data[i] = mpu_read(FIFO_R_W);
+		}
+		if (length < 1)
+			bus_time(0);
+	} else {
+		// the data registers hold still during a burst read
+		bus_time(length);
+	}
+
+	if (address == mpu_address) {
+		if (mpu_ptr != FIFO_R_W) {
+			for (int i = 0; i < length; ++i) {
+				data[i] = mpu_read(mpu_ptr);
+				mpu_ptr = (mpu_ptr + 1) & 0x7F;
+			}
+		}
+		if (mpu_regs[INT_PIN_CFG] & INT_PIN_CFG_ANYRD_2CLEAR)
+			mpu_regs[INT_STATUS] = 0;
+	} else if (address == AK8963_ADDRESS && mag_reachable()) {
+		for (int i = 0; i < length; ++i)
+			data[i] = mag_read(mag_ptr++ & 0x1F);
+	} else {
+		++bus_stats.nacks;
+		memset(data, 0xFF, length);
+	}
+}
+
+void SimulatedDriver::delay(uint32_t milli_seconds) {
+	advance_to_ns(now_ns + (uint64_t)milli_seconds * 1000000ULL);
+}
+
+bool SimulatedDriver::wait_interrupt(uint32_t timeout_ms) {
+	if (!interrupt_line)
+		return false;
+	const uint64_t deadline = now_ns + (uint64_t)timeout_ms * 1000000ULL;
+	for (;;) {
+		if (int_pending) {
+			int_pending = false;
+			return true;
+		}
+		if (now_ns >= deadline)
+			return false;
+		advance_to_ns(next_sample_ns < deadline ? next_sample_ns : deadline);
+	}
+}
+
+void SimulatedDriver::advance(uint64_t us) {
+	advance_to_ns(now_ns + us * 1000ULL);
+}
+
+void SimulatedDriver::advance_to_ns(uint64_t target_ns) {
+	for (;;) {
+		uint64_t mag_period = mag_period_ns();
+		bool mag_due = mag_period && next_mag_ns <= target_ns;
+		bool mpu_due = next_sample_ns <= target_ns;
+		if (!mag_due && !mpu_due)
+			break;
+		if (mag_due && (!mpu_due || next_mag_ns <= next_sample_ns)) {
+			now_ns = next_mag_ns;
+			MotionSample s;
+			motion.sample(now_ns / 1000, s);
+			produce_mag(s);
+			next_mag_ns += mag_period;
+		} else {
+			now_ns = next_sample_ns;
+			if (!(mpu_regs[PWR_MGMT_1] & PWR_MGMT_1_SLEEP))
+				produce_sample();
+			next_sample_ns += sample_period_ns();
+		}
+	}
+	if (target_ns > now_ns)
+		now_ns = target_ns;
+}
+
+uint64_t SimulatedDriver::sample_period_ns() const {
+	// same rules as the device: fchoice_b bypasses the DLPF (32 kHz),
+	// DLPF_CFG 7 runs the internal rate at 8 kHz, otherwise 1 kHz
+	if (mpu_regs[GYRO_CONFIG] & GYRO_CONFIG_Fchoice_b_MASK)
+		return 31250;
+	uint64_t internal_ns = ((mpu_regs[MPU_CONFIG] & MPU_CONFIG_DLPF_CFG_MASK) == 7) ? 125000 : 1000000;
+	return internal_ns * (1 + mpu_regs[SMPLRT_DIV]);
+}
+
+uint64_t SimulatedDriver::mag_period_ns() const {
+	switch (mag_regs[AK8963_CNTL] & AK8963_CNTL1_MODE_MASK) {
+		case 0x02: return 125000000;  // continuous 1, 8 Hz
+		case 0x06: return 10000000;   // continuous 2, 100 Hz
+		default:   return 0;
+	}
+}
+
+float SimulatedDriver::noise(float stddev) {
+	if (stddev <= 0.f)
+		return 0.f;
+	std::normal_distribution<float> dist(0.f, stddev);
+	return dist(rng);
+}
+
+void SimulatedDriver::produce_sample() {
+	MotionSample s;
+	motion.sample(now_ns / 1000, s);
+	last_truth = s;
+
+	const uint8_t acc_fs = (mpu_regs[ACCEL_CONFIG] >> 3) & 0x03;
+	const uint8_t gyro_fs = (mpu_regs[GYRO_CONFIG] >> 3) & 0x03;
+	const double acc_lsb = 16384. / (1 << acc_fs);       // LSB/g
+	const double gyro_lsb = 32768. / (250. * (1 << gyro_fs));  // LSB/(deg/s)
+
+	int16_t out[7];
+	for (int i = 0; i < 3; ++i) {
+		// accel offset registers hold 2048 LSB/g, gyro offset registers 32.8 LSB/(deg/s)
+		int16_t acc_offset = (int16_t)((mpu_regs[XA_OFFSET_H + 3 * i] << 8) | mpu_regs[XA_OFFSET_L + 3 * i]);
+		int16_t gyro_offset = (int16_t)((mpu_regs[XG_OFFSET_H + 2 * i] << 8) | mpu_regs[XG_OFFSET_L + 2 * i]);
+		double acc = s.acc[i] + errors.acc_bias[i] + noise(errors.acc_noise) + acc_offset / 2048.;
+		double gyro = s.gyro[i] + errors.gyro_bias[i] + noise(errors.gyro_noise) + gyro_offset / 32.768;
+		out[i] = saturate(acc * acc_lsb);
+		out[4 + i] = saturate(gyro * gyro_lsb);
+	}
+	out[3] = saturate((25. - 21.) * 333.87);  // 25 degC
+
+	for (int i = 0; i < 7; ++i) {
+		mpu_regs[ACCEL_XOUT_H + 2 * i] = (uint8_t)(out[i] >> 8);
+		mpu_regs[ACCEL_XOUT_H + 2 * i + 1] = (uint8_t)(out[i] & 0xFF);
+	}
+
+	if (mpu_regs[USER_CTRL] & USER_CTRL_I2C_MST_EN)
+		run_i2c_master();
+
+	// FIFO, in register order
+	if (mpu_regs[USER_CTRL] & USER_CTRL_FIFO_EN) {
+		const uint8_t en = mpu_regs[FIFO_EN];
+		uint8_t frame[32];
+		uint8_t n = 0;
+		if (en & FIFO_EN_ACCEL)
+			for (uint8_t r = ACCEL_XOUT_H; r <= ACCEL_ZOUT_L; ++r) frame[n++] = mpu_regs[r];
+		if (en & FIFO_EN_TEMP)
+			for (uint8_t r = TEMP_OUT_H; r <= TEMP_OUT_L; ++r) frame[n++] = mpu_regs[r];
+		if (en & FIFO_EN_GYROX)
+			for (uint8_t r = GYRO_XOUT_H; r <= GYRO_XOUT_L; ++r) frame[n++] = mpu_regs[r];
+		if (en & FIFO_EN_GYROY)
+			for (uint8_t r = GYRO_YOUT_H; r <= GYRO_YOUT_L; ++r) frame[n++] = mpu_regs[r];
+		if (en & FIFO_EN_GYROZ)
+			for (uint8_t r = GYRO_ZOUT_H; r <= GYRO_ZOUT_L; ++r) frame[n++] = mpu_regs[r];
+		if (en & FIFO_EN_SLV_0) {
+			uint8_t len = mpu_regs[I2C_SLV0_CTRL] & I2C_SLV_CTRL_LENG_MASK;
+			for (uint8_t i = 0; i < len; ++i) frame[n++] = mpu_regs[EXT_SENS_DATA_00 + i];
+		}
+
+		if (fifo.size() + n > FIFO_SIZE) {
+			mpu_regs[INT_STATUS] |= INT_STATUS_FIFO_OVERFLOW;
+			if (mpu_regs[MPU_CONFIG] & MPU_CONFIG_FIFO_MODE)
+				n = 0;  // drop new data
+			else
+				while (fifo.size() + n > FIFO_SIZE) fifo.pop_front();  // overwrite oldest
+		}
+		fifo.insert(fifo.end(), frame, frame + n);
+	}
+
+	mpu_regs[INT_STATUS] |= INT_STATUS_RAW_RDY;
+	if (mpu_regs[INT_ENABLE] & INT_ENABLE_RAW_RDY)
+		int_pending = true;
+	++n_samples;
+}
+
+void SimulatedDriver::run_i2c_master() {
+	const uint8_t ctrl = mpu_regs[I2C_SLV0_CTRL];
+	const uint8_t addr = mpu_regs[I2C_SLV0_ADDR];
+	if (!(ctrl & I2C_SLV_CTRL_EN) || !(addr & I2C_SLV_ADDR_RW))
+		return;
+	if ((addr & I2C_SLV_ADDR_MASK) != AK8963_ADDRESS) {
+		mpu_regs[I2C_MST_STATUS] |= I2C_MST_STATUS_SLV0_NACK;
+		return;
+	}
+	const uint8_t len = ctrl & I2C_SLV_CTRL_LENG_MASK;
+	for (uint8_t i = 0; i < len; ++i)
+		mpu_regs[EXT_SENS_DATA_00 + i] = mag_read((mpu_regs[I2C_SLV0_REG] + i) & 0x1F);
+}
+
+void SimulatedDriver::produce_mag(const MotionSample& s) {
+	const bool bits16 = mag_regs[AK8963_CNTL] & AK8963_CNTL1_BIT;
+	const double resolution = bits16 ? 10. * 4912. / 32760. : 10. * 4912. / 8190.;  // mG/LSB
+	for (int i = 0; i < 3; ++i) {
+		double asa = (errors.mag_asa[i] - 128) / 256. + 1.;
+		double m = s.mag[i] * errors.mag_soft_iron[i] + errors.mag_hard_iron[i] + noise(errors.mag_noise);
+		int16_t count = saturate(m / (resolution * asa));
+		mag_regs[AK8963_XOUT_L + 2 * i] = (uint8_t)(count & 0xFF);
+		mag_regs[AK8963_XOUT_H + 2 * i] = (uint8_t)(count >> 8);
+	}
+	mag_regs[AK8963_ST2] = bits16 ? AK8963_ST2_BITM : 0;
+	if (mag_regs[AK8963_ST1] & AK8963_ST1_DRDY)
+		mag_regs[AK8963_ST1] |= AK8963_ST1_DOR;  // previous data was not read
+	mag_regs[AK8963_ST1] |= AK8963_ST1_DRDY;
+}
+
+uint8_t SimulatedDriver::mpu_read(uint8_t reg) {
+	uint8_t v = mpu_regs[reg];
+	switch (reg) {
+		case FIFO_COUNTH:
+			return (uint8_t)((fifo.size() >> 8) & FIFO_COUNTH_MASK);
+		case FIFO_COUNTL:
+			return (uint8_t)(fifo.size() & 0xFF);
+		case FIFO_R_W:
+			if (fifo.empty())
+				return 0xFF;
+			v = fifo.front();
+			fifo.pop_front();
+			return v;
+		case INT_STATUS:
+			mpu_regs[INT_STATUS] = 0;  // cleared on read
+			return v;
+		case I2C_MST_STATUS:
+			mpu_regs[I2C_MST_STATUS] &= ~I2C_MST_STATUS_SLV4_DONE;
+			return v;
+		default:
+			return v;
+	}
+}
+
+void SimulatedDriver::mpu_write(uint8_t reg, uint8_t data) {
+	switch (reg) {
+		case WHO_AM_I_MPU9250:
+		case INT_STATUS:
+		case I2C_MST_STATUS:
+		case FIFO_COUNTH:
+		case FIFO_COUNTL:
+			return;  // read only
+		case FIFO_R_W:
+			if (fifo.size() < FIFO_SIZE)
+				fifo.push_back(data);
+			return;
+		case PWR_MGMT_1:
+			if (data & PWR_MGMT_1_H_RESET)
+				reset_mpu();
+			else
+				mpu_regs[reg] = data;
+			return;
+		case USER_CTRL:
+			if (data & USER_CTRL_FIFO_RST)
+				fifo.clear();
+			// reset bits clear themselves
+			mpu_regs[reg] = data & ~(USER_CTRL_FIFO_RST | USER_CTRL_I2C_MST_RST | USER_CTRL_SIG_COND_RST);
+			return;
+		case I2C_SLV4_CTRL:
+			mpu_regs[reg] = data;
+			if ((data & I2C_SLV4_CTRL_EN) && (mpu_regs[USER_CTRL] & USER_CTRL_I2C_MST_EN)) {
+				const uint8_t addr = mpu_regs[I2C_SLV4_ADDR];
+				if ((addr & I2C_SLV_ADDR_MASK) != AK8963_ADDRESS) {
+					mpu_regs[I2C_MST_STATUS] |= I2C_MST_STATUS_SLV4_NACK;
+				} else if (addr & I2C_SLV_ADDR_RW) {
+					mpu_regs[I2C_SLV4_DI] = mag_read(mpu_regs[I2C_SLV4_REG] & 0x1F);
+				} else {
+					mag_write(mpu_regs[I2C_SLV4_REG] & 0x1F, mpu_regs[I2C_SLV4_DO]);
+				}
+				mpu_regs[I2C_MST_STATUS] |= I2C_MST_STATUS_SLV4_DONE;
+				mpu_regs[reg] &= ~I2C_SLV4_CTRL_EN;
+			}
+			return;
+		default:
+			if (reg >= ACCEL_XOUT_H && reg <= EXT_SENS_DATA_23)
+				return;  // sensor data is read only
+			mpu_regs[reg] = data;
+			return;
+	}
+}
+
+uint8_t SimulatedDriver::mag_read(uint8_t reg) {
+	switch (reg) {
+		case AK8963_ASAX:
+		case AK8963_ASAY:
+		case AK8963_ASAZ:
+			return errors.mag_asa[reg - AK8963_ASAX];
+		case AK8963_ST2:
+			// reading ST2 ends the data read and releases DRDY/DOR
+			mag_regs[AK8963_ST1] &= ~(AK8963_ST1_DRDY | AK8963_ST1_DOR);
+			return mag_regs[reg];
+		default:
+			return mag_regs[reg];
+	}
+}
+
+void SimulatedDriver::mag_write(uint8_t reg, uint8_t data) {
+	switch (reg) {
+		case AK8963_CNTL:
+			mag_regs[reg] = data;
+			next_mag_ns = now_ns + mag_period_ns();
+			return;
+		case AK8963_CNTL2:
+			if (data & AK8963_CNTL2_SRST)
+				reset_mag();
+			return;
+		case AK8963_WHO_AM_I:
+		case AK8963_INFO:
+		case AK8963_ST1:
+		case AK8963_ST2:
+			return;  // read only
+		default:
+			if (reg >= AK8963_XOUT_L && reg <= AK8963_ZOUT_H)
+				return;
+			mag_regs[reg] = data;
+			return;
+	}
+}
+
+///////////////////////////////
+// Shared bus
+///////////////////////////////
+
+bool SimulatedBus::attach(SimulatedDriver& device) {
+	if (n_devices >= MAX_DEVICES)
+		return false;
+	if (n_devices)
+		device.advanceToNs(devices[0]->nowNs());
+	devices[n_devices++] = &device;
+	return true;
+}
+
+SimulatedDriver* SimulatedBus::route(uint8_t address) {
+	if (n_devices == 0)
+		return nullptr;
+	for (uint8_t i = 0; i < n_devices; ++i)
+		if (devices[i]->address() == address)
+			return devices[i];
+	// AK8963 in bypass mode, or nobody: the first device records the NACK
+	for (uint8_t i = 0; i < n_devices; ++i)
+		if (devices[i]->magReachable())
+			return devices[i];
+	return devices[0];
+}
+
+void SimulatedBus::sync(const SimulatedDriver* from) {
+	for (uint8_t i = 0; i < n_devices; ++i)
+		if (devices[i] != from)
+			devices[i]->advanceToNs(from->nowNs());
+}
+
+void SimulatedBus::write(uint8_t address, const uint8_t* data, int length) {
+	SimulatedDriver* d = route(address);
+	if (!d)
+		return;
+	d->write(address, data, length);
+	sync(d);
+}
+
+void SimulatedBus::read(uint8_t address, uint8_t* data, int length) {
+	SimulatedDriver* d = route(address);
+	if (!d)
+		return;
+	d->read(address, data, length);
+	sync(d);
+}
+
+void SimulatedBus::delay(uint32_t milli_seconds) {
+	advance((uint64_t)milli_seconds * 1000);
+}
+
+void SimulatedBus::advance(uint64_t us) {
+	for (uint8_t i = 0; i < n_devices; ++i)
+		devices[i]->advance(us);
+}
+
+SimulatedDriver::Stats SimulatedBus::stats() const {
+	SimulatedDriver::Stats total;
+	for (uint8_t i = 0; i < n_devices; ++i) {
+		const SimulatedDriver::Stats& s = devices[i]->stats();
+		total.transactions += s.transactions;
+		total.bytes_written += s.bytes_written;
+		total.bytes_read += s.bytes_read;
+		total.nacks += s.nacks;
+	}
+	return total;
+}
+
+void SimulatedBus::resetStats() {
+	for (uint8_t i = 0; i < n_devices; ++i)
+		devices[i]->resetStats();
+}
+
+} // namespace MPU9250
@@ -0,0 +1,192 @@
+#ifndef MPU9250_SIMULATEDDRIVER_H
+#define MPU9250_SIMULATEDDRIVER_H
+#include <MPU9250.h>
+#include <stdint.h>
+#include <deque>
+#include <random>
+#include <vector>
+
+// Host side simulation of an MPU9250 + AK8963 behind the Driver interface.
+// Not part of the Arduino library, it is built by the host tools in extras/.
+
+namespace MPU9250 {
+
+// Physical sensor values at one point in time, in the sensor axes used
+// by MPU::update() (accel/gyro: X-forward, Z-up, mag: Y-forward, Z-down).
+struct MotionSample {
+	float acc[3];   // [g]
+	float gyro[3];  // [deg/s]
+	float mag[3];   // [mG]
+	float q[4];     // reference orientation (w, x, y, z) in the filter frame
+};
+
+class MotionSource {
+public:
+	virtual ~MotionSource() {}
+	// called with non-decreasing time
+	virtual void sample(uint64_t time_us, MotionSample& s) =0;
+};
+
+// Smooth synthetic rotation: the body rate is a sum of sinusoids and the
+// orientation is integrated from it, sensor values are derived from
+// gravity and the earth magnetic field in that orientation.
+class SyntheticMotion : public MotionSource {
+public:
+	float rate_amplitude[3] {60.f, 45.f, 90.f};  // [deg/s]
+	float rate_frequency[3] {0.11f, 0.07f, 0.05f};  // [Hz]
+	float field_strength {480.f};                // [mG]
+	float field_inclination {49.f};              // [deg], positive down
+
+	virtual void sample(uint64_t time_us, MotionSample& s) override;
+
+private:
+	double q[4] {1., 0., 0., 0.};
+	uint64_t last_time_us {0};
+	bool started {false};
+
+	void rate_at(double t, double* w) const;
+};
+
+// Replays a recorded trace with sample-and-hold between records.
+class TraceMotion : public MotionSource {
+public:
+	struct Record {
+		uint64_t time_us;
+		MotionSample s;
+	};
+	std::vector<Record> records;
+
+	// CSV lines: time_us,ax,ay,az,gx,gy,gz,mx,my,mz[,qw,qx,qy,qz]
+	bool load(const char* path);
+	virtual void sample(uint64_t time_us, MotionSample& s) override;
+
+private:
+	size_t index {0};
+};
+
+// Sensor imperfections applied on top of the motion source.
+struct SensorErrors {
+	float acc_bias[3] {0.f, 0.f, 0.f};      // [g]
+	float gyro_bias[3] {0.f, 0.f, 0.f};     // [deg/s]
+	float mag_hard_iron[3] {0.f, 0.f, 0.f}; // [mG]
+	float mag_soft_iron[3] {1.f, 1.f, 1.f}; // per axis gain
+	float acc_noise {0.f};                  // standard deviation [g]
+	float gyro_noise {0.f};                 // [deg/s]
+	float mag_noise {0.f};                  // [mG]
+	uint8_t mag_asa[3] {128, 128, 128};     // fuse ROM sensitivity adjustment
+};
+
+class SimulatedDriver final : public Driver {
+public:
+	struct Stats {
+		uint64_t transactions {0};
+		uint64_t bytes_written {0};
+		uint64_t bytes_read {0};
+		uint64_t nacks {0};
+	};
+
+	SimulatedDriver(MotionSource& motion, uint8_t mpu_address = 0x68);
+
+	// bus model: every transaction costs address + data bytes at 9 bits each
+	uint32_t bus_hz {400000};
+	// model a wired INT pin (has_interrupt() / wait_interrupt())
+	bool interrupt_line {false};
+	SensorErrors errors;
+
+	virtual void write(uint8_t address, const uint8_t* data, int length) override;
+	virtual void read(uint8_t address, uint8_t* data, int length) override;
+	virtual void delay(uint32_t milli_seconds) override;
+	virtual bool has_interrupt() override { return interrupt_line; }
+	virtual bool wait_interrupt(uint32_t timeout_ms) override;
+	virtual bool has_clock() override { return true; }
+	virtual uint32_t micros() override { return (uint32_t)now(); }
+
+	// virtual clock
+	uint64_t now() const { return now_ns / 1000; }
+	uint64_t nowNs() const { return now_ns; }
+	void advance(uint64_t us);
+	void advanceToNs(uint64_t target_ns) { advance_to_ns(target_ns); }
+	uint8_t address() const { return mpu_address; }
+	bool magReachable() const { return mag_reachable(); }
+
+	const Stats& stats() const { return bus_stats; }
+	void resetStats() { bus_stats = Stats{}; }
+	// reference values of the latest sample produced by the device
+	const MotionSample& truth() const { return last_truth; }
+	uint64_t samples() const { return n_samples; }
+
+	uint8_t mpuRegister(uint8_t reg) const { return mpu_regs[reg & 0x7F]; }
+	uint8_t magRegister(uint8_t reg) const { return mag_regs[reg & 0x1F]; }
+
+private:
+	static constexpr uint8_t AK8963_ADDRESS {0x0C};
+	static constexpr uint16_t FIFO_SIZE {512};
+
+	MotionSource& motion;
+	uint8_t mpu_address;
+
+	uint8_t mpu_regs[128];
+	uint8_t mag_regs[32];
+	uint8_t mpu_ptr {0};
+	uint8_t mag_ptr {0};
+	std::deque<uint8_t> fifo;
+
+	// nanoseconds, so that short bus transactions accumulate exactly
+	uint64_t now_ns {0};
+	uint64_t next_sample_ns {0};
+	uint64_t next_mag_ns {0};
+	uint64_t n_samples {0};
+	bool int_pending {false};
+	MotionSample last_truth {};
+	Stats bus_stats;
+	std::mt19937 rng {1};
+
+	void reset_mpu();
+	void reset_mag();
+	bool mag_reachable() const;
+	void bus_time(int length);
+	void advance_to_ns(uint64_t target_ns);
+
+	uint8_t mpu_read(uint8_t reg);
+	void mpu_write(uint8_t reg, uint8_t data);
+	uint8_t mag_read(uint8_t reg);
+	void mag_write(uint8_t reg, uint8_t data);
+
+	uint64_t sample_period_ns() const;
+	uint64_t mag_period_ns() const;
+	void produce_sample();
+	void produce_mag(const MotionSample& s);
+	void run_i2c_master();
+	float noise(float stddev);
+};
+
+// Several simulated devices on one bus. Transactions go to the device at
+// the addressed MPU9250 (or whose AK8963 is reachable), all devices share
+// the virtual clock.
+class SimulatedBus : public Driver {
+public:
+	bool attach(SimulatedDriver& device);
+
+	virtual void write(uint8_t address, const uint8_t* data, int length) override;
+	virtual void read(uint8_t address, uint8_t* data, int length) override;
+	virtual void delay(uint32_t milli_seconds) override;
+	virtual bool has_clock() override { return true; }
+	virtual uint32_t micros() override { return (uint32_t)now(); }
+
+	uint64_t now() const { return n_devices ? devices[0]->now() : 0; }
+	void advance(uint64_t us);
+	SimulatedDriver::Stats stats() const;
+	void resetStats();
+
+private:
+	static constexpr uint8_t MAX_DEVICES {8};
+	SimulatedDriver* devices[MAX_DEVICES] {};
+	uint8_t n_devices {0};
+
+	SimulatedDriver* route(uint8_t address);
+	void sync(const SimulatedDriver* from);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_SIMULATEDDRIVER_H
@@ -0,0 +1,87 @@
+#include "ThreadedBus.h"
+#include <chrono>
+
+namespace MPU9250 {
+
+ThreadedBus::ThreadedBus(SimulatedDriver& device)
+: device(device), worker(&ThreadedBus::run, this) {
+}
+
+ThreadedBus::~ThreadedBus() {
+	{
+		std::lock_guard<std::mutex> lock(job_mutex);
+		stop = true;
+	}
+	job_cv.notify_one();
+	worker.join();
+}
+
+void ThreadedBus::wait_bus(int length) {
+	// address byte + data bytes, 9 clocks each
+	uint64_t ns = (uint64_t)(length + 1) * 9 * 1000000000ULL / device.bus_hz;
+	std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+}
+
+void ThreadedBus::write(uint8_t address, const uint8_t* data, int length) {
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		device.write(address, data, length);
+	}
+	wait_bus(length);
+}
+
+void ThreadedBus::read(uint8_t address, uint8_t* data, int length) {
+	{
+		std::lock_guard<std::mutex> lock(device_mutex);
+		device.read(address, data, length);
+	}
+	wait_bus(length);
+}
+
+void ThreadedBus::delay(uint32_t milli_seconds) {
+	std::lock_guard<std::mutex> lock(device_mutex);
+	device.delay(milli_seconds);
+}
+
+uint32_t ThreadedBus::micros() {
+	std::lock_guard<std::mutex> lock(device_mutex);
+	return (uint32_t)device.now();
+}
+
+void ThreadedBus::advance(uint64_t us) {
+	std::lock_guard<std::mutex> lock(device_mutex);
+	device.advance(us);
+}
+
+bool ThreadedBus::submit_read(uint8_t address, uint8_t reg, uint8_t* data, int length) {
+	if (busy.load())
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(job_mutex);
+		job_address = address;
+		job_reg = reg;
+		job_data = data;
+		job_length = length;
+		has_job = true;
+		busy.store(true);
+	}
+	job_cv.notify_one();
+	return true;
+}
+
+void ThreadedBus::run() {
+	for (;;) {
+		std::unique_lock<std::mutex> lock(job_mutex);
+		job_cv.wait(lock, [this] { return has_job || stop; });
+		if (stop)
+			return;
+		has_job = false;
+		lock.unlock();
+
+		write(job_address, &job_reg, 1);
+		read(job_address, job_data, job_length);
+		busy.store(false);
+	}
+}
+
+} // namespace MPU9250
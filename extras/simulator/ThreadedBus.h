@@ -0,0 +1,55 @@
+#ifndef MPU9250_THREADEDBUS_H
+#define MPU9250_THREADEDBUS_H
+#include "SimulatedDriver.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace MPU9250 {
+
+// AsyncDriver in front of a SimulatedDriver. Every transaction takes its bus
+// time in real time (sleeping, like a CPU waiting on a peripheral), and
+// submit_read() hands the transfer to a worker thread, the way a DMA engine
+// would, so the caller can compute while the bus is busy.
+class ThreadedBus final : public AsyncDriver {
+public:
+	explicit ThreadedBus(SimulatedDriver& device);
+	~ThreadedBus();
+
+	// synchronous transfers
+	virtual void write(uint8_t address, const uint8_t* data, int length) override;
+	virtual void read(uint8_t address, uint8_t* data, int length) override;
+	virtual void delay(uint32_t milli_seconds) override;
+	virtual bool has_clock() override { return true; }
+	virtual uint32_t micros() override;
+
+	// asynchronous register read
+	virtual bool submit_read(uint8_t address, uint8_t reg, uint8_t* data, int length) override;
+	virtual bool transfer_done() override { return !busy.load(); }
+
+	// advance the simulated device (virtual time only)
+	void advance(uint64_t us);
+
+private:
+	SimulatedDriver& device;
+	std::mutex device_mutex;  // device state, shared with the worker
+
+	std::mutex job_mutex;
+	std::condition_variable job_cv;
+	bool has_job {false};
+	bool stop {false};
+	std::atomic<bool> busy {false};
+	uint8_t job_address {0};
+	uint8_t job_reg {0};
+	uint8_t* job_data {nullptr};
+	int job_length {0};
+	std::thread worker;  // last, starts running in the constructor
+
+	void run();
+	void wait_bus(int length);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_THREADEDBUS_H
@@ -0,0 +1,440 @@
+// Correctness checks of the host build, registered with CTest.
+//
+//   mpu9250_tests [--trace file.csv] [test...]
+//
+// Without test names every test runs. The exit status is 1 if one of
+// them fails. --trace replaces the recording in tests/data, it is in the
+// TraceMotion CSV format (see SimulatedDriver.h).
+
+#include "SimulatedDriver.h"
+#include "ThreadedBus.h"
+#include <FilterBank.h>
+#include <FrameDecode.h>
+#include <MPU9250.h>
+#include <MPU9250Utility.h>
+#include <QuaternionFilter.h>
+#include <SampleQueue.h>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+using namespace MPU9250;
+
+namespace {
+
+const char* trace_path = MPU9250_TEST_DATA_DIR "/motion_trace.csv";
+
+// angle of the rotation between two unit quaternions [deg]
+double angle_deg(const float* q, const float* r) {
+	double d = fabs((double)q[0] * r[0] + (double)q[1] * r[1] + (double)q[2] * r[2] + (double)q[3] * r[3]);
+	return 2. * acos(d > 1. ? 1. : d) * 180. / 3.14159265358979;
+}
+
+// MadgwickFilterFloat against MadgwickFilter (double) on the recording,
+// fed as in MPU::update_filter() at 10 iterations. Their quaternions must
+// stay within MADGWICK_FLOAT_TOLERANCE_DEG of each other at every sample.
+constexpr double MADGWICK_FLOAT_TOLERANCE_DEG {0.2};
+
+bool test_madgwick_float() {
+	TraceMotion trace;
+	if (!trace.load(trace_path)) {
+		fprintf(stderr, "%s: no records\n", trace_path);
+		return false;
+	}
+	MadgwickFilterFloat madgwick_float;
+	MadgwickFilter madgwick;
+	float q[4] {1.f, 0.f, 0.f, 0.f}, q_ref[4] {1.f, 0.f, 0.f, 0.f};
+	const size_t iterations = 10;
+	const float deg2rad = 3.14159265f / 180.f;
+	double max_deg = 0.;
+	for (size_t i = 1; i < trace.records.size(); ++i) {
+		const MotionSample& s = trace.records[i].s;
+		const double dt = (trace.records[i].time_us - trace.records[i - 1].time_us) * 1e-6 / iterations;
+		for (size_t k = 0; k < iterations; ++k) {
+			madgwick_float.update_impl(-s.acc[0], s.acc[1], s.acc[2],
+			                           s.gyro[0] * deg2rad, -s.gyro[1] * deg2rad, -s.gyro[2] * deg2rad,
+			                           s.mag[1], -s.mag[0], s.mag[2], dt, q);
+			madgwick.update_impl(-s.acc[0], s.acc[1], s.acc[2],
+			                     s.gyro[0] * deg2rad, -s.gyro[1] * deg2rad, -s.gyro[2] * deg2rad,
+			                     s.mag[1], -s.mag[0], s.mag[2], dt, q_ref);
+		}
+		const double deg = angle_deg(q, q_ref);
+		if (deg > max_deg || deg != deg)
+			max_deg = deg;  // a NaN stays and fails the check
+	}
+	printf("madgwick_float: max %.4f deg from double over %zu samples\n", max_deg, trace.records.size());
+	return max_deg <= MADGWICK_FLOAT_TOLERANCE_DEG;
+}
+
+// exportState() / setup(state): a blob round trips with more than 255
+// filter iterations, and blobs with a valid CRC but 0 iterations or an
+// out of range Setting are rejected before the bus is touched.
+bool test_state() {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	MadgwickFilter filter;
+	MPU mpu;
+	if (mpu.setup(0x68, d, filter) != Error::NONE)
+		return false;
+	mpu.setFilterIterations(300);
+	uint8_t state[MPU::STATE_SIZE], again[MPU::STATE_SIZE];
+	const size_t size = mpu.exportState(state, sizeof(state));
+	if (size == 0)
+		return false;
+
+	MadgwickFilter filter_restored;
+	MPU restored;
+	bool ok = restored.setup(0x68, d, filter_restored, state, size) == Error::NONE;
+	ok &= restored.exportState(again, sizeof(again)) == size && !memcmp(state, again, size);
+
+	// payload offsets: header 4, accel_fs_sel 4, gyro_dlpf_cfg 9,
+	// mag_via_i2c_master 12, iterations 93 (u16)
+	const struct { size_t offset; uint8_t value; } invalid[] {
+		{4, 4}, {9, 8}, {12, 2}, {93, 0},
+	};
+	for (const auto& c : invalid) {
+		memcpy(again, state, size);
+		again[c.offset] = c.value;
+		if (c.offset == 93)
+			again[94] = 0;
+		put_u16(again + size - 2, crc16_ccitt(again, size - 2));
+		MPU rejected;
+		d.resetStats();
+		ok &= rejected.setup(0x68, d, filter_restored, again, size) == Error::STATE;
+		ok &= d.stats().transactions == 0;
+	}
+	return ok;
+}
+
+// Forwards to a simulated device whose reset never completes: PWR_MGMT_1
+// reads back with H_RESET set.
+class StuckResetDriver : public Driver {
+public:
+	explicit StuckResetDriver(SimulatedDriver& d) : d(d) {}
+	virtual void write(uint8_t address, const uint8_t* data, int length) override {
+		reg = length > 0 ? data[0] : reg;
+		d.write(address, data, length);
+	}
+	virtual void read(uint8_t address, uint8_t* data, int length) override {
+		d.read(address, data, length);
+		if (address == d.address() && reg == PWR_MGMT_1 && length > 0)
+			data[0] |= PWR_MGMT_1_H_RESET;
+	}
+	virtual void delay(uint32_t milli_seconds) override { d.delay(milli_seconds); }
+	virtual bool has_clock() override { return true; }
+	virtual uint32_t micros() override { return d.micros(); }
+
+private:
+	SimulatedDriver& d;
+	uint8_t reg {0};
+};
+
+// A warm start that times out polling the device is Error::TIMEOUT, and
+// calibrateAccelGyro() gives up on a device that does not finish its reset.
+bool test_warm_start_timeout() {
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	MadgwickFilter filter;
+	MPU mpu;
+	if (mpu.setup(0x68, d, filter) != Error::NONE)
+		return false;
+	Calibration cal;
+	mpu.getCalibration(cal);
+
+	StuckResetDriver stuck(d);
+	MPU warm;
+	bool ok = warm.setup(0x68, stuck, filter, cal) == Error::TIMEOUT;
+	ok &= warm.setup(0x68, d, filter, cal) == Error::NONE;
+	ok &= mpu.setup(0x68, stuck, filter) == Error::NONE;  // fixed delays, no polling
+	const uint64_t start_us = d.now();
+	ok &= !mpu.calibrateAccelGyro();
+	printf("warm_start_timeout: calibration gave up after %.1f ms\n", (d.now() - start_us) * 1e-3);
+	return ok;
+}
+
+// MadgwickFilter that records whether a bus transfer is in flight while
+// it runs.
+class OverlapProbe : public Filter {
+public:
+	explicit OverlapProbe(ThreadedBus& bus) : bus(bus) {}
+	uint64_t steps {0}, overlapped {0};
+
+	virtual void update_impl(float ax, float ay, float az,
+                           float gx, float gy, float gz,
+                           float mx, float my, float mz,
+                           double deltaT, float* q) override {
+		++steps;
+		overlapped += !bus.transfer_done();
+		madgwick.update_impl(ax, ay, az, gx, gy, gz, mx, my, mz, deltaT, q);
+	}
+
+private:
+	ThreadedBus& bus;
+	MadgwickFilter madgwick;
+};
+
+// updateAsync() on a bus that takes real time (ThreadedBus), next to
+// app_us of other work per loop. It has to run the filter while the next
+// frame is on the bus: at least 90% of the filter steps with a transfer
+// in flight. update() never overlaps, which shows that the probe works.
+// Returns the share of overlapped steps and the wall time per sample.
+double overlap(bool async, uint64_t n, double& wall_us) {
+	const uint64_t app_us = 400;
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	ThreadedBus bus(d);
+	OverlapProbe probe(bus);
+	AsyncMPU mpu;
+	Setting setting;
+	setting.mag_via_i2c_master = true;
+	setting.fifo_sample_rate = FIFO_SAMPLE_RATE::SMPL_1000HZ;
+	if (mpu.setup(0x68, bus, probe, setting) != Error::NONE)
+		return -1.;
+	mpu.setFilterIterations(10);
+	probe.steps = probe.overlapped = 0;
+
+	uint64_t samples = 0;
+	auto wall = std::chrono::steady_clock::now();
+	while (samples < n) {
+		if (async ? mpu.updateAsync() : mpu.update())
+			++samples;
+		auto work = std::chrono::steady_clock::now();
+		while (std::chrono::steady_clock::now() - work < std::chrono::microseconds(app_us)) {}
+		bus.advance(app_us);
+	}
+	wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - wall).count() / (double)n;
+	while (!bus.transfer_done()) {}
+	return probe.steps ? (double)probe.overlapped / probe.steps : 0.;
+}
+
+bool test_async_overlap() {
+	double sync_us, async_us;
+	const double sync_share = overlap(false, 200, sync_us);
+	const double async_share = overlap(true, 200, async_us);
+	printf("async_overlap: %.0f%% of the filter steps overlapped (sync %.0f%%), %.0f us/sample (sync %.0f us)\n",
+	       async_share * 100., sync_share * 100., async_us, sync_us);
+	return sync_share == 0. && async_share >= 0.9;
+}
+
+// decode_frames() against decode_frames_scalar() on random bytes, for
+// every burst length up to a full FIFO, so that the SIMD tails are covered.
+// Both decode in place like readFifoScaled(), the results must be
+// identical.
+bool test_decode_frames() {
+	const size_t max_burst = 36;  // 14 byte frames in the 512 byte FIFO
+	const float scale[DECODE_FRAME_WORDS] {1.f / 16384.f, 1.f / 16384.f, 1.f / 16384.f, 1.f / 333.87f,
+	                                       250.f / 32768.f, 250.f / 32768.f, 250.f / 32768.f};
+	const float offset[DECODE_FRAME_WORDS] {0.f, 0.f, 0.f, 21.f, 0.f, 0.f, 0.f};
+	std::vector<uint8_t> raw(max_burst * 14);
+	std::vector<float> out(max_burst * DECODE_FRAME_WORDS), ref(max_burst * DECODE_FRAME_WORDS);
+	uint32_t x = 1;
+	bool ok = true;
+	for (size_t burst = 1; burst <= max_burst; ++burst) {
+		for (uint8_t& b : raw) {
+			x = x * 1664525u + 1013904223u;
+			b = (uint8_t)(x >> 24);
+		}
+		uint8_t* packed = reinterpret_cast<uint8_t*>(out.data()) + burst * 14;
+		memcpy(packed, raw.data(), burst * 14);
+		decode_frames(packed, burst, scale, offset, out.data());
+		packed = reinterpret_cast<uint8_t*>(ref.data()) + burst * 14;
+		memcpy(packed, raw.data(), burst * 14);
+		decode_frames_scalar(packed, burst, scale, offset, ref.data());
+		if (memcmp(out.data(), ref.data(), burst * DECODE_FRAME_WORDS * sizeof(float))) {
+			fprintf(stderr, "decode_frames: %s differs from scalar at %zu frames\n", decode_kernel(), burst);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// A filter bank on the recording, every instance on other samples, has to
+// end up where each instance's Filter does. Bit exact in the default
+// build, with -march=native the compiler may fuse multiply-adds in the
+// Filter.
+template <typename BankT, typename FilterT>
+bool bank_matches(const char* name, const TraceMotion& trace) {
+	const size_t n_steps = 1000;
+	const size_t n_records = trace.records.size();
+	BankT bank;
+	const size_t n_inst = bank.size();
+	for (size_t k = 0; k < n_steps; ++k) {
+		for (size_t i = 0; i < n_inst; ++i) {
+			const MotionSample& s = trace.records[(k + 37 * i) % n_records].s;
+			bank.setSensor(i, s.acc, s.gyro, s.mag);
+		}
+		bank.update(0.005f);
+	}
+	bool ok = true;
+	for (size_t i = 0; i < n_inst; ++i) {
+		FilterT filter;
+		float q_ref[4] {1.f, 0.f, 0.f, 0.f}, q[4];
+		for (size_t k = 0; k < n_steps; ++k) {
+			const MotionSample& s = trace.records[(k + 37 * i) % n_records].s;
+			filter.update_impl(-s.acc[0], s.acc[1], s.acc[2],
+			                   deg_to_rad(s.gyro[0]), -deg_to_rad(s.gyro[1]), -deg_to_rad(s.gyro[2]),
+			                   s.mag[1], -s.mag[0], s.mag[2], 0.005f, q_ref);
+		}
+		bank.getQuaternion(i, q);
+		for (uint8_t j = 0; j < 4; ++j)
+			ok &= fabsf(q[j] - q_ref[j]) <= 1e-4f;
+	}
+	if (!ok)
+		fprintf(stderr, "bank %s (%s): %zu instances differ from the Filter\n", name, bank_kernel(), n_inst);
+	return ok;
+}
+
+bool test_filter_banks() {
+	TraceMotion trace;
+	if (!trace.load(trace_path)) {
+		fprintf(stderr, "%s: no records\n", trace_path);
+		return false;
+	}
+	// 13 leaves a partial block
+	bool ok = bank_matches<MadgwickBank<1>, MadgwickFilterFloat>("madgwick", trace);
+	ok &= bank_matches<MadgwickBank<4>, MadgwickFilterFloat>("madgwick", trace);
+	ok &= bank_matches<MadgwickBank<13>, MadgwickFilterFloat>("madgwick", trace);
+	ok &= bank_matches<MadgwickBank<64>, MadgwickFilterFloat>("madgwick", trace);
+	ok &= bank_matches<MahonyBank<1>, MahonyFilter>("mahony", trace);
+	ok &= bank_matches<MahonyBank<4>, MahonyFilter>("mahony", trace);
+	ok &= bank_matches<MahonyBank<13>, MahonyFilter>("mahony", trace);
+	ok &= bank_matches<MahonyBank<64>, MahonyFilter>("mahony", trace);
+	return ok;
+}
+
+// SPSCQueue under load: update() pushes FIFO samples from one thread, and
+// a second thread pops them and sleeps for stall_us every stall_every
+// samples. FIFO timestamps are exactly one ODR period apart, so the frames
+// missing between the first and the last timestamp have to match the
+// counted overflows, and popped + overflows the frames the device
+// produced.
+bool queue_accounts(uint16_t capacity, uint32_t stall_every, uint32_t stall_us, uint64_t n) {
+	const uint32_t period_us = 1000;
+	SyntheticMotion motion;
+	SimulatedDriver d(motion);
+	MadgwickFilter filter;
+	MPU mpu;
+	Setting setting;
+	setting.mag_via_i2c_master = true;
+	setting.fifo_sample_rate = FIFO_SAMPLE_RATE::SMPL_1000HZ;
+	if (mpu.setup(0x68, d, filter, setting) != Error::NONE)
+		return false;
+	mpu.enableFifo();
+	std::vector<Sample> storage(capacity + 1);
+	SPSCQueue<Sample> queue(storage.data(), capacity + 1);
+	mpu.attachQueue(&queue);
+
+	std::atomic<bool> started {false}, done {false};
+	uint64_t popped = 0, gaps = 0, bad = 0;
+	uint32_t first_time = 0, last_time = 0;
+	std::thread consumer([&] {
+		Sample s;
+		started.store(true, std::memory_order_release);
+		for (;;) {
+			bool finished = done.load(std::memory_order_acquire);
+			if (!queue.pop(s)) {
+				if (finished)
+					break;
+				std::this_thread::yield();
+				continue;
+			}
+			if (popped == 0) {
+				first_time = s.timestamp;
+			} else {
+				uint32_t dt = s.timestamp - last_time;
+				if (dt == 0 || dt % period_us != 0)
+					++bad;
+				else
+					gaps += dt / period_us - 1;
+			}
+			last_time = s.timestamp;
+			// descheduled, as by a higher priority task
+			if (++popped % stall_every == 0)
+				std::this_thread::sleep_for(std::chrono::microseconds(stall_us));
+		}
+	});
+	while (!started.load(std::memory_order_acquire)) {}
+
+	// every frame the device produces from here on goes through the FIFO
+	const uint64_t first = d.samples();
+	while (d.samples() - first < n) {
+		mpu.update();
+		d.advance(2 * period_us);
+		// lets the consumer run on a single core too
+		std::this_thread::yield();
+	}
+	while (mpu.update()) {}
+	done.store(true, std::memory_order_release);
+	consumer.join();
+
+	const uint64_t pushed = d.samples() - first;
+	const uint64_t overflows = queue.overflows();
+	// drops before the first and after the last popped sample leave no gap
+	const uint32_t pushed_first = mpu.getTimestamp() - (uint32_t)(pushed - 1) * period_us;
+	if (popped > 0)
+		gaps += (first_time - pushed_first) / period_us + (mpu.getTimestamp() - last_time) / period_us;
+	else
+		gaps = pushed;
+	printf("sample_queue: capacity %u: pushed %llu popped %llu overflows %llu gaps %llu bad %llu\n",
+	       capacity, (unsigned long long)pushed, (unsigned long long)popped,
+	       (unsigned long long)overflows, (unsigned long long)gaps, (unsigned long long)bad);
+	return bad == 0 && popped + overflows == pushed && gaps == overflows;
+}
+
+bool test_sample_queue() {
+	bool ok = queue_accounts(256, 1000, 10, 10000);
+	ok &= queue_accounts(16, 50, 200, 10000);
+	return ok;
+}
+
+struct Test {
+	const char* name;
+	bool (*run)();
+};
+
+const Test tests[] {
+	{"madgwick_float", test_madgwick_float},
+	{"state", test_state},
+	{"warm_start_timeout", test_warm_start_timeout},
+	{"async_overlap", test_async_overlap},
+	{"decode_frames", test_decode_frames},
+	{"filter_banks", test_filter_banks},
+	{"sample_queue", test_sample_queue},
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+	constexpr size_t n_tests = sizeof(tests) / sizeof(tests[0]);
+	bool selected[n_tests] {};
+	bool any_selected = false;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			trace_path = argv[++i];
+			continue;
+		}
+		size_t k = 0;
+		while (k < n_tests && strcmp(argv[i], tests[k].name))
+			++k;
+		if (k == n_tests) {
+			fprintf(stderr, "usage: %s [--trace file.csv] [test...]\n", argv[0]);
+			return 2;
+		}
+		selected[k] = any_selected = true;
+	}
+
+	bool ok = true;
+	for (size_t k = 0; k < n_tests; ++k) {
+		if (any_selected && !selected[k])
+			continue;
+		const bool passed = tests[k].run();
+		printf("%s: %s\n", tests[k].name, passed ? "passed" : "FAILED");
+		ok &= passed;
+	}
+	return ok ? 0 : 1;
+}
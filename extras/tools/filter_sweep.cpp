@@ -0,0 +1,380 @@
+// Tuning of the filter gains on a recording, without a board.
+//
+//   mpu9250_filter_sweep [--trace file.csv] [--seconds N] [--filter madgwick|mahony|eskf|all]
+//                        [--beta LIST] [--kp LIST] [--ki LIST] [--iterations LIST]
+//                        [--acc-noise LIST] [--mag-noise LIST] [--gyro-bias DPS]
+//                        [--warm-up S] [--threads N]
+//
+// Replays the recording through MadgwickFilter for every beta and through
+// MahonyFilter for every Kp and Ki, each at every iteration count, and
+// through EskfFilter (always 1 iteration) for every measurement noise. The
+// jobs are spread over all cores (or --threads) by a work stealing pool.
+// A LIST is comma separated values or a range start:stop:step.
+//
+// The trace is in the TraceMotion CSV format (time_us, acc [g], gyro
+// [deg/s], mag [mG] in the sensor frame, and the reference quaternion).
+// Without --trace the synthetic motion is sampled at 200 Hz with the
+// sensor noise of the simulator, and --gyro-bias adds a constant bias
+// [deg/s] to each axis.
+//
+// Output is CSV, one row per setting: the error against the reference
+// orientation after the warm-up (RMS, max) and the time per sample. The
+// error columns are empty for a trace without quaternion columns. The best
+// setting per filter goes to stderr.
+
+#include "SimulatedDriver.h"
+#include <EskfFilter.h>
+#include <MPU9250Utility.h>
+#include <QuaternionFilter.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <math.h>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace MPU9250;
+
+namespace {
+
+// Runs jobs 0..n-1 on n_threads threads. Each thread has its own deque of
+// jobs and works from its back, and when that is empty takes jobs from the
+// front of the others, so slow jobs (many iterations) do not leave threads
+// idle at the end.
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(unsigned n_threads) : queues(n_threads ? n_threads : 1) {}
+
+	void run(size_t n, const std::function<void(size_t)>& job) {
+		for (size_t i = 0; i < n; ++i)
+			queues[i % queues.size()].jobs.push_back(i);
+		std::vector<std::thread> threads;
+		for (size_t t = 0; t < queues.size(); ++t)
+			threads.emplace_back([this, t, &job] { work(t, job); });
+		for (std::thread& t : threads)
+			t.join();
+	}
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<size_t> jobs;
+	};
+	std::vector<Queue> queues;
+
+	bool pop(size_t t, size_t& i) {
+		{
+			std::lock_guard<std::mutex> lock(queues[t].mutex);
+			if (!queues[t].jobs.empty()) {
+				i = queues[t].jobs.back();
+				queues[t].jobs.pop_back();
+				return true;
+			}
+		}
+		// no job is added while running, so all queues empty means done
+		for (size_t k = 1; k < queues.size(); ++k) {
+			Queue& victim = queues[(t + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.jobs.empty()) {
+				i = victim.jobs.front();
+				victim.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(size_t t, const std::function<void(size_t)>& job) {
+		size_t i;
+		while (pop(t, i))
+			job(i);
+	}
+};
+
+// one sample in the filter frame, as BasicMPU::update_filter() feeds it
+struct Input {
+	float a[3];
+	float g[3];  // [rad/s]
+	float m[3];
+	float q[4];  // reference
+	float dt;    // [s] since the previous sample
+	bool measured;  // after the warm-up
+};
+
+struct Options {
+	const char* trace {nullptr};
+	double seconds {600.};
+	double warm_up {2.};
+	float gyro_bias {0.f};
+	unsigned threads {0};
+	bool madgwick {true};
+	bool mahony {true};
+	bool eskf {true};
+	std::vector<float> beta;
+	std::vector<float> kp;
+	std::vector<float> ki;
+	std::vector<float> iterations;
+	std::vector<float> acc_noise;
+	std::vector<float> mag_noise;
+};
+
+enum class Kind { MADGWICK, MAHONY, ESKF };
+
+struct Job {
+	Kind kind;
+	float beta, kp, ki, acc_noise, mag_noise;
+	size_t iterations;
+	// results
+	uint64_t samples;
+	double err_rms, err_max, ns_per_sample;
+};
+
+// "a,b,c" or "start:stop:step"
+bool parse_list(const char* s, std::vector<float>& out) {
+	out.clear();
+	float start, stop, step;
+	if (sscanf(s, "%f:%f:%f", &start, &stop, &step) == 3) {
+		if (step <= 0.f || stop < start)
+			return false;
+		for (int i = 0; start + i * step <= stop + step * 1e-3f; ++i)
+			out.push_back(start + i * step);
+		return true;
+	}
+	for (const char* p = s; *p;) {
+		char* end;
+		out.push_back(strtof(p, &end));
+		if (end == p || (*end != ',' && *end != '\0'))
+			return false;
+		p = *end ? end + 1 : end;
+	}
+	return !out.empty();
+}
+
+// angle of the rotation between two unit quaternions [deg]
+double angle_deg(const float* p, const float* q) {
+	double d = fabs((double)p[0] * q[0] + (double)p[1] * q[1] + (double)p[2] * q[2] + (double)p[3] * q[3]);
+	return 2. * acos(d > 1. ? 1. : d) * 180. / 3.14159265358979;
+}
+
+void push_input(std::vector<Input>& inputs, uint64_t time_us, uint64_t prev_us, uint64_t start_us,
+                const MotionSample& s, const Options& opt) {
+	Input in;
+	in.a[0] = -s.acc[0];
+	in.a[1] = +s.acc[1];
+	in.a[2] = +s.acc[2];
+	in.g[0] = +deg_to_rad(s.gyro[0]);
+	in.g[1] = -deg_to_rad(s.gyro[1]);
+	in.g[2] = -deg_to_rad(s.gyro[2]);
+	in.m[0] = +s.mag[1];
+	in.m[1] = -s.mag[0];
+	in.m[2] = +s.mag[2];
+	memcpy(in.q, s.q, sizeof(in.q));
+	in.dt = (float)((time_us - prev_us) * 1e-6);
+	in.measured = time_us - start_us >= opt.warm_up * 1e6;
+	inputs.push_back(in);
+}
+
+std::vector<Input> load_inputs(const Options& opt, bool& has_reference) {
+	std::vector<Input> inputs;
+	if (opt.trace) {
+		TraceMotion trace;
+		if (!trace.load(opt.trace)) {
+			fprintf(stderr, "%s: no records\n", opt.trace);
+			exit(1);
+		}
+		has_reference = false;
+		const uint64_t start = trace.records[0].time_us;
+		uint64_t prev = start;
+		for (const TraceMotion::Record& r : trace.records) {
+			has_reference |= r.s.q[0] != 1.f;
+			push_input(inputs, r.time_us, prev, start, r.s, opt);
+			prev = r.time_us;
+		}
+		return inputs;
+	}
+
+	// noise as in the simulated device (SensorErrors), with a fixed seed
+	SyntheticMotion motion;
+	std::mt19937 rng {1};
+	std::normal_distribution<float> acc_noise(0.f, 0.002f), gyro_noise(0.f, 0.05f), mag_noise(0.f, 1.f);
+	has_reference = true;
+	const uint64_t period_us = 5000;
+	for (uint64_t t = 0; t < opt.seconds * 1e6; t += period_us) {
+		MotionSample s;
+		motion.sample(t, s);
+		for (uint8_t i = 0; i < 3; ++i) {
+			s.acc[i] += acc_noise(rng);
+			s.gyro[i] += gyro_noise(rng) + opt.gyro_bias;
+			s.mag[i] += mag_noise(rng);
+		}
+		push_input(inputs, t, t ? t - period_us : 0, 0, s, opt);
+	}
+	return inputs;
+}
+
+template <typename FilterT>
+void replay(FilterT& filter, const std::vector<Input>& inputs, bool has_reference, Job& job) {
+	float q[4] {1.f, 0.f, 0.f, 0.f};
+	double sum_sq = 0., max = 0.;
+	uint64_t n = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const Input& in : inputs) {
+		const double dt = (double)in.dt / job.iterations;
+		for (size_t k = 0; k < job.iterations; ++k)
+			filter.update_impl(in.a[0], in.a[1], in.a[2], in.g[0], in.g[1], in.g[2],
+			                   in.m[0], in.m[1], in.m[2], dt, q);
+		if (has_reference && in.measured) {
+			const double e = angle_deg(q, in.q);
+			sum_sq += e * e;
+			if (e > max) max = e;
+			++n;
+		}
+	}
+	const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	job.samples = inputs.size();
+	job.err_rms = n ? sqrt(sum_sq / n) : 0.;
+	job.err_max = max;
+	job.ns_per_sample = inputs.empty() ? 0. : ns / inputs.size();
+}
+
+void print_job(const Job& j, bool has_reference) {
+	if (j.kind == Kind::MADGWICK)
+		printf("madgwick,%g,,,,,", j.beta);
+	else if (j.kind == Kind::MAHONY)
+		printf("mahony,,%g,%g,,,", j.kp, j.ki);
+	else
+		printf("eskf,,,,%g,%g,", j.acc_noise, j.mag_noise);
+	printf("%zu,%llu,", j.iterations, (unsigned long long)j.samples);
+	if (has_reference)
+		printf("%.4f,%.4f,", j.err_rms, j.err_max);
+	else
+		printf(",,");
+	printf("%.1f\n", j.ns_per_sample);
+}
+
+int usage(const char* name) {
+	fprintf(stderr,
+		"usage: %s [--trace file.csv] [--seconds N] [--filter madgwick|mahony|eskf|all]\n"
+		"       [--beta LIST] [--kp LIST] [--ki LIST] [--iterations LIST]\n"
+		"       [--acc-noise LIST] [--mag-noise LIST] [--gyro-bias DPS] [--warm-up S] [--threads N]\n"
+		"LIST: a,b,c or start:stop:step\n", name);
+	return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options opt;
+	parse_list("0.05:1.5:0.05", opt.beta);
+	parse_list("1,2,5,10,20,30,50", opt.kp);
+	parse_list("0,0.01,0.1,0.5", opt.ki);
+	parse_list("1,5,10,20", opt.iterations);
+	parse_list("0.03", opt.acc_noise);
+	parse_list("0.05", opt.mag_noise);
+	for (int i = 1; i < argc; ++i) {
+		const bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "--trace") && has_value)
+			opt.trace = argv[++i];
+		else if (!strcmp(argv[i], "--seconds") && has_value)
+			opt.seconds = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--warm-up") && has_value)
+			opt.warm_up = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--gyro-bias") && has_value)
+			opt.gyro_bias = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && has_value)
+			opt.threads = strtoul(argv[++i], nullptr, 10);
+		else if (!strcmp(argv[i], "--filter") && has_value) {
+			const char* f = argv[++i];
+			opt.madgwick = !strcmp(f, "madgwick") || !strcmp(f, "all");
+			opt.mahony = !strcmp(f, "mahony") || !strcmp(f, "all");
+			opt.eskf = !strcmp(f, "eskf") || !strcmp(f, "all");
+			if (!opt.madgwick && !opt.mahony && !opt.eskf)
+				return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--beta") && has_value) {
+			if (!parse_list(argv[++i], opt.beta)) return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--kp") && has_value) {
+			if (!parse_list(argv[++i], opt.kp)) return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--ki") && has_value) {
+			if (!parse_list(argv[++i], opt.ki)) return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--iterations") && has_value) {
+			if (!parse_list(argv[++i], opt.iterations)) return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--acc-noise") && has_value) {
+			if (!parse_list(argv[++i], opt.acc_noise)) return usage(argv[0]);
+		} else if (!strcmp(argv[i], "--mag-noise") && has_value) {
+			if (!parse_list(argv[++i], opt.mag_noise)) return usage(argv[0]);
+		} else
+			return usage(argv[0]);
+	}
+	for (float it : opt.iterations)
+		if (it < 1.f) return usage(argv[0]);
+
+	bool has_reference = false;
+	const std::vector<Input> inputs = load_inputs(opt, has_reference);
+
+	std::vector<Job> jobs;
+	for (float it : opt.iterations) {
+		if (opt.madgwick)
+			for (float beta : opt.beta)
+				jobs.push_back(Job {Kind::MADGWICK, beta, 0.f, 0.f, 0.f, 0.f, (size_t)it, 0, 0., 0., 0.});
+		if (opt.mahony)
+			for (float kp : opt.kp)
+				for (float ki : opt.ki)
+					jobs.push_back(Job {Kind::MAHONY, 0.f, kp, ki, 0.f, 0.f, (size_t)it, 0, 0., 0., 0.});
+	}
+	if (opt.eskf)
+		for (float acc : opt.acc_noise)
+			for (float mag : opt.mag_noise)
+				jobs.push_back(Job {Kind::ESKF, 0.f, 0.f, 0.f, acc, mag, 1, 0, 0., 0., 0.});
+
+	const unsigned n_threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+	WorkStealingPool pool(n_threads);
+	auto start = std::chrono::steady_clock::now();
+	pool.run(jobs.size(), [&](size_t i) {
+		Job& job = jobs[i];
+		if (job.kind == Kind::MADGWICK) {
+			MadgwickFilter filter;
+			filter.setBeta(job.beta);
+			replay(filter, inputs, has_reference, job);
+		} else if (job.kind == Kind::MAHONY) {
+			MahonyFilter filter;
+			filter.setGains(job.kp, job.ki);
+			replay(filter, inputs, has_reference, job);
+		} else {
+			EskfFilter filter;
+			filter.setMeasurementNoise(job.acc_noise, job.mag_noise);
+			replay(filter, inputs, has_reference, job);
+		}
+	});
+	const double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("filter,beta,kp,ki,acc_noise,mag_noise,iterations,samples,err_rms_deg,err_max_deg,ns_per_sample\n");
+	const Job* best[3] {nullptr, nullptr, nullptr};
+	for (const Job& j : jobs) {
+		print_job(j, has_reference);
+		const Job*& b = best[(int)j.kind];
+		if (!b || j.err_rms < b->err_rms)
+			b = &j;
+	}
+
+	fprintf(stderr, "%zu settings x %zu samples on %u threads in %.2f s\n",
+	        jobs.size(), inputs.size(), n_threads ? n_threads : 1, wall_s);
+	if (has_reference) {
+		if (best[0])
+			fprintf(stderr, "best madgwick: beta %g, %zu iterations, %.4f deg RMS\n",
+			        best[0]->beta, best[0]->iterations, best[0]->err_rms);
+		if (best[1])
+			fprintf(stderr, "best mahony: Kp %g, Ki %g, %zu iterations, %.4f deg RMS\n",
+			        best[1]->kp, best[1]->ki, best[1]->iterations, best[1]->err_rms);
+		if (best[2])
+			fprintf(stderr, "best eskf: acc noise %g, mag noise %g, %.4f deg RMS\n",
+			        best[2]->acc_noise, best[2]->mag_noise, best[2]->err_rms);
+	}
+	return 0;
+}
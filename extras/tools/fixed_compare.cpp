@@ -0,0 +1,145 @@
+// Accuracy of the fixed point filters against their float versions.
+//
+//   mpu9250_fixed_compare [--trace file.csv] [--seconds N] [--iterations N]
+//
+// Each pair runs on two identical simulated devices (same motion, same
+// noise sequence) in lockstep, BasicMPU<FloatFilter> against
+// BasicMPU<FixedFilter>, so the float scaling and filter are compared with
+// the whole raw count path. Without --trace the synthetic motion is used,
+// a trace is a recording in the TraceMotion CSV format.
+//
+// Output is CSV, one row per filter: the angle between the float and the
+// fixed orientation (RMS, max) and the RMS error of either against the
+// reference orientation, after a warm-up of 2 s. The reference columns are
+// empty for a trace without quaternion columns.
+
+#include "SimulatedDriver.h"
+#include <FixedFilter.h>
+#include <MPU9250Impl.h>  // BasicMPU<FloatT>, BasicMPU<FixedT>
+#include <math.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace MPU9250;
+
+namespace {
+
+struct Options {
+	const char* trace {nullptr};
+	double seconds {60.};
+	size_t iterations {10};
+};
+
+struct Stats {
+	double sum_sq {0.};
+	double max {0.};
+	uint64_t n {0};
+	void add(double x) {
+		sum_sq += x * x;
+		if (x > max) max = x;
+		++n;
+	}
+	double rms() const { return n ? sqrt(sum_sq / n) : 0.; }
+};
+
+// angle of the rotation between two unit quaternions [deg]
+double angle_deg(const float* p, const float* q) {
+	double d = fabs((double)p[0] * q[0] + (double)p[1] * q[1] + (double)p[2] * q[2] + (double)p[3] * q[3]);
+	return 2. * acos(d > 1. ? 1. : d) * 180. / 3.14159265358979;
+}
+
+std::unique_ptr<MotionSource> make_motion(const Options& opt, bool& has_reference) {
+	if (!opt.trace) {
+		has_reference = true;
+		return std::unique_ptr<MotionSource>(new SyntheticMotion);
+	}
+	std::unique_ptr<TraceMotion> trace(new TraceMotion);
+	if (!trace->load(opt.trace)) {
+		fprintf(stderr, "%s: no records\n", opt.trace);
+		exit(1);
+	}
+	has_reference = false;
+	for (const TraceMotion::Record& r : trace->records)
+		has_reference |= r.s.q[0] != 1.f;
+	return std::unique_ptr<MotionSource>(trace.release());
+}
+
+void configure_errors(SimulatedDriver& d) {
+	d.errors.acc_noise = 0.002f;
+	d.errors.gyro_noise = 0.05f;
+	d.errors.mag_noise = 1.f;
+	d.errors.mag_asa[0] = 140;
+	d.errors.mag_asa[1] = 120;
+}
+
+template <typename FloatT, typename FixedT>
+void compare(const char* name, const Options& opt) {
+	bool has_reference = false;
+	std::unique_ptr<MotionSource> m_float = make_motion(opt, has_reference);
+	std::unique_ptr<MotionSource> m_fixed = make_motion(opt, has_reference);
+	SimulatedDriver d_float(*m_float), d_fixed(*m_fixed);
+	configure_errors(d_float);
+	configure_errors(d_fixed);
+
+	FloatT f_float;
+	FixedT f_fixed;
+	BasicMPU<FloatT> mpu_float;
+	BasicMPU<FixedT> mpu_fixed;
+	if (mpu_float.setup(0x68, d_float, f_float) != Error::NONE || mpu_fixed.setup(0x68, d_fixed, f_fixed) != Error::NONE) {
+		fprintf(stderr, "%s: setup failed\n", name);
+		exit(1);
+	}
+	mpu_float.setFilterIterations(opt.iterations);
+	mpu_fixed.setFilterIterations(opt.iterations);
+
+	Stats diff, err_float, err_fixed;
+	const uint64_t start = d_float.now();
+	const uint64_t warm_up = 2000000;
+	while (d_float.now() - start < opt.seconds * 1e6) {
+		d_float.advance(5000);  // 200 Hz
+		d_fixed.advance(5000);
+		const bool u_float = mpu_float.update();
+		const bool u_fixed = mpu_fixed.update();
+		if (!u_float || !u_fixed || d_float.now() - start < warm_up)
+			continue;
+		const float qf[4] {mpu_float.getQuaternionW(), mpu_float.getQuaternionX(), mpu_float.getQuaternionY(), mpu_float.getQuaternionZ()};
+		const float qx[4] {mpu_fixed.getQuaternionW(), mpu_fixed.getQuaternionX(), mpu_fixed.getQuaternionY(), mpu_fixed.getQuaternionZ()};
+		diff.add(angle_deg(qf, qx));
+		if (has_reference) {
+			err_float.add(angle_deg(qf, d_float.truth().q));
+			err_fixed.add(angle_deg(qx, d_fixed.truth().q));
+		}
+	}
+
+	printf("%s,%zu,%llu,%.6f,%.6f", name, opt.iterations, (unsigned long long)diff.n, diff.rms(), diff.max);
+	if (has_reference)
+		printf(",%.4f,%.4f\n", err_float.rms(), err_fixed.rms());
+	else
+		printf(",,\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options opt;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			opt.trace = argv[++i];
+		else if (!strcmp(argv[i], "--seconds") && i + 1 < argc)
+			opt.seconds = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+			opt.iterations = strtoul(argv[++i], nullptr, 10);
+		else {
+			fprintf(stderr, "usage: %s [--trace file.csv] [--seconds N] [--iterations N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	printf("filter,iterations,samples,diff_rms_deg,diff_max_deg,float_err_rms_deg,fixed_err_rms_deg\n");
+	compare<SimpleFilter, FixedSimpleFilter>("simple", opt);
+	compare<MadgwickFilter, FixedMadgwickFilter>("madgwick", opt);
+	compare<MahonyFilter, FixedMahonyFilter>("mahony", opt);
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef MPU9250_ESKFFILTER_H
+#define MPU9250_ESKFFILTER_H
+#include <Matrix.h>
+#include <QuaternionFilter.h>
+
+namespace MPU9250 {
+
+// Error state Kalman filter for orientation and gyro bias.
+//
+// The quaternion is propagated with the bias corrected gyro, and a 6 state
+// error (rotation in the body frame, gyro bias) with its covariance
+// corrects it from the accelerometer (gravity) and the magnetometer
+// (heading, against the horizontal field direction as MadgwickFilter uses
+// it). One call is one complete predict and update, so use it with
+// setFilterIterations(1), more iterations would take every measurement
+// several times.
+//
+// acc is expected in g as BasicMPU passes it: the further its magnitude
+// is from 1 g (linear acceleration), the less the accelerometer is trusted.
+// The gyro bias estimate is kept by save_state() / load_state().
+class EskfFilter final : public Filter {
+public:
+	EskfFilter();
+
+	// gyro noise density [rad/s/sqrt(Hz)] and bias random walk [rad/s^2/sqrt(Hz)]
+	void setGyroNoise(float noise, float bias_walk);
+	// measurement noise of the acc and mag directions [rad]
+	void setMeasurementNoise(float acc, float mag);
+	// forget the bias and the confidence in the current orientation
+	void reset();
+
+	const float* getBias() const { return bias; }  // [rad/s], filter frame
+
+	virtual void update_impl(float ax, float ay, float az,
+                           float gx, float gy, float gz,
+                           float mx, float my, float mz,
+                           double deltaT, float* q) override;
+	virtual uint8_t save_state(uint8_t* dest) const override;
+	virtual bool load_state(const uint8_t* src, uint8_t size) override;
+
+private:
+	// covariance in 3x3 blocks: rotation, rotation/bias, bias
+	Matrix3<> p_tt, p_tb, p_bb;
+	float bias[3] {0.f, 0.f, 0.f};
+
+	float gyro_var_density;  // squared noise densities
+	float bias_var_density;
+	float acc_var;           // squared measurement noise
+	float mag_var;
+
+	void correct(const Vector3<>& residual, const Vector3<>& predicted, float var, float* q);
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_ESKFFILTER_H
@@ -0,0 +1,127 @@
+#ifndef MPU9250_FILTERBANK_H
+#define MPU9250_FILTERBANK_H
+#include <MPU9250Utility.h>
+#include <QuaternionFilter.h>
+
+namespace MPU9250 {
+
+// N independent Madgwick or Mahony filters advanced together, for rigs of
+// several IMUs or to run one recording through many gain settings.
+//
+// State and inputs are kept as structure of arrays, one float per instance
+// in each field, and update() runs the instances side by side in SIMD lanes
+// (AVX, SSE2 or AArch64 NEON, whatever the compiler targets, or one at a
+// time elsewhere or with MPU9250_NO_SIMD). Every instance computes exactly
+// what its Filter class computes, see MadgwickBank and MahonyBank.
+//
+// All instances share dt. Fill the inputs with setInput() / setSensor(), or
+// directly through field(), then call update().
+
+// instances are processed in blocks of this many, the arrays are padded to it
+constexpr uint8_t BANK_BLOCK {8};
+
+enum BankField : uint8_t {
+	BANK_Q0, BANK_Q1, BANK_Q2, BANK_Q3,
+	// inputs in the frame and units of Filter::update_impl()
+	BANK_AX, BANK_AY, BANK_AZ,
+	BANK_GX, BANK_GY, BANK_GZ,
+	BANK_MX, BANK_MY, BANK_MZ,
+	BANK_COMMON_FIELDS,
+};
+
+// data: FIELDS rows of stride floats, see BasicFilterBank
+void madgwick_bank_update(float* data, size_t stride, float dt);
+void mahony_bank_update(float* data, size_t stride, float dt);
+// "avx", "sse2", "neon" or "scalar"
+const char* bank_kernel();
+
+template <size_t N, uint8_t FIELDS>
+class BasicFilterBank {
+public:
+	static constexpr size_t STRIDE {(N + BANK_BLOCK - 1) / BANK_BLOCK * BANK_BLOCK};
+
+	size_t size() const { return N; }
+
+	// inputs as passed to Filter::update_impl(), gyro in rad/s
+	void setInput(size_t i, float ax, float ay, float az,
+	              float gx, float gy, float gz,
+	              float mx, float my, float mz) {
+		data[BANK_AX][i] = ax; data[BANK_AY][i] = ay; data[BANK_AZ][i] = az;
+		data[BANK_GX][i] = gx; data[BANK_GY][i] = gy; data[BANK_GZ][i] = gz;
+		data[BANK_MX][i] = mx; data[BANK_MY][i] = my; data[BANK_MZ][i] = mz;
+	}
+	// sensor frame readings, acc [g], gyro [deg/s] and mag [mG] as from
+	// getAcc() etc., mapped to the filter frame like BasicMPU::update_filter()
+	void setSensor(size_t i, const float* acc, const float* gyro, const float* mag) {
+		setInput(i, -acc[0], acc[1], acc[2],
+		         deg_to_rad(gyro[0]), -deg_to_rad(gyro[1]), -deg_to_rad(gyro[2]),
+		         mag[1], -mag[0], mag[2]);
+	}
+
+	void getQuaternion(size_t i, float* q) const {
+		for (uint8_t k = 0; k < 4; ++k)
+			q[k] = data[BANK_Q0 + k][i];
+	}
+	void setQuaternion(size_t i, const float* q) {
+		for (uint8_t k = 0; k < 4; ++k)
+			data[BANK_Q0 + k][i] = q[k];
+	}
+
+	// one row of STRIDE floats, for filling or reading all instances at once
+	float* field(uint8_t f) { return data[f]; }
+	const float* field(uint8_t f) const { return data[f]; }
+
+protected:
+	// padding instances keep zero inputs, which leave them as they are
+	alignas(32) float data[FIELDS][STRIDE] {};
+
+	BasicFilterBank() {
+		for (size_t i = 0; i < STRIDE; ++i)
+			data[BANK_Q0][i] = 1.f;
+	}
+	void fill(uint8_t f, float v) {
+		for (size_t i = 0; i < STRIDE; ++i)
+			data[f][i] = v;
+	}
+};
+
+// MadgwickFilterFloat per instance, with its own beta
+template <size_t N>
+class MadgwickBank : public BasicFilterBank<N, BANK_COMMON_FIELDS + 1> {
+public:
+	static constexpr uint8_t BANK_BETA {BANK_COMMON_FIELDS};
+
+	// the default of MadgwickFilter, 40 deg/s gyro error
+	MadgwickBank() { this->fill(BANK_BETA, sqrt(3.0f / 4.0f) * (pi * (40.0f / 180.0f))); }
+
+	void setBeta(float beta) { this->fill(BANK_BETA, beta); }
+	void setBeta(size_t i, float beta) { this->data[BANK_BETA][i] = beta; }
+
+	void update(float dt) { madgwick_bank_update(&this->data[0][0], this->STRIDE, dt); }
+};
+
+// MahonyFilter per instance, with its own Kp, Ki and integral terms
+template <size_t N>
+class MahonyBank : public BasicFilterBank<N, BANK_COMMON_FIELDS + 5> {
+public:
+	static constexpr uint8_t BANK_KP {BANK_COMMON_FIELDS};
+	static constexpr uint8_t BANK_KI {BANK_COMMON_FIELDS + 1};
+	static constexpr uint8_t BANK_IX {BANK_COMMON_FIELDS + 2};  // .. BANK_IZ, [rad/s]
+
+	MahonyBank() { this->fill(BANK_KP, 30.f); }
+
+	void setGains(float kp, float ki) {
+		this->fill(BANK_KP, kp);
+		this->fill(BANK_KI, ki);
+	}
+	void setGains(size_t i, float kp, float ki) {
+		this->data[BANK_KP][i] = kp;
+		this->data[BANK_KI][i] = ki;
+	}
+
+	void update(float dt) { mahony_bank_update(&this->data[0][0], this->STRIDE, dt); }
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_FILTERBANK_H
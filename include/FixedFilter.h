@@ -0,0 +1,77 @@
+#ifndef MPU9250_FIXEDFILTER_H
+#define MPU9250_FIXEDFILTER_H
+#include <FixedPoint.h>
+#include <QuaternionFilter.h>
+
+namespace MPU9250 {
+
+// Filters in Q8.24 fixed point for cores without an FPU (AVR, Cortex-M0+),
+// where every float operation is a library call.
+//
+// With BasicMPU<FixedMadgwickFilter> (etc.) the filter is fed from the raw
+// counts through precomputed integer scales, see BasicMPU::update_filter(),
+// and the only float work per sample left in the update path is the
+// scaling for getAccX() etc. and update_rpy(). Through the float
+// update_impl() they work like any other Filter, also with MPU, but then
+// the inputs are converted from float on every call.
+//
+// The quaternion is kept in fixed point between calls and taken over from
+// the caller's float quaternion whenever that was changed from outside
+// (reset, importState()).
+class FixedFilter : public Filter {
+public:
+	// acc, mag: unit vectors in the filter frame (north, east, down), see
+	// q24_normalize(), or zero when there is no measurement. gyro [rad/s]
+	// and dt [s]. Like MadgwickFilter, FixedMadgwickFilter skips the update
+	// for a zero acc or mag.
+	virtual void update_fixed(const q24_t* acc, const q24_t* gyro, const q24_t* mag, q24_t dt) =0;
+
+	virtual void update_impl(float ax, float ay, float az,
+                           float gx, float gy, float gz,
+                           float mx, float my, float mz,
+                           double deltaT, float* q) override;
+
+	// take over q if it is not the quaternion last written by write_quaternion()
+	void sync_quaternion(const float* q);
+	void write_quaternion(float* q);
+
+protected:
+	q24_t qf[4] {Q24_ONE, 0, 0, 0};
+
+private:
+	float q_written[4] {1.f, 0.f, 0.f, 0.f};
+};
+
+class FixedSimpleFilter final : public FixedFilter {
+public:
+	virtual void update_fixed(const q24_t* acc, const q24_t* gyro, const q24_t* mag, q24_t dt) override;
+};
+
+// MadgwickFilter with the same gain
+class FixedMadgwickFilter final : public FixedFilter {
+private:
+	q24_t beta {to_q24(0.8660254f * 3.14159265f * 40.f / 180.f)};  // sqrt(3/4) * 40 deg/s
+public:
+	void setBeta(float b) { beta = to_q24(b); }
+	float getBeta() const { return from_q24(beta); }
+	virtual void update_fixed(const q24_t* acc, const q24_t* gyro, const q24_t* mag, q24_t dt) override;
+};
+
+// MahonyFilter with the same gains, the integral terms are in Q8.24 rad/s
+class FixedMahonyFilter final : public FixedFilter {
+private:
+	q24_t Kp {to_q24(30.f)};
+	q24_t Ki {0};
+	q24_t ix {0}, iy {0}, iz {0};
+public:
+	void setGains(float kp, float ki) { Kp = to_q24(kp); Ki = to_q24(ki); }
+	float getKp() const { return from_q24(Kp); }
+	float getKi() const { return from_q24(Ki); }
+	virtual void update_fixed(const q24_t* acc, const q24_t* gyro, const q24_t* mag, q24_t dt) override;
+	virtual uint8_t save_state(uint8_t* dest) const override;
+	virtual bool load_state(const uint8_t* src, uint8_t size) override;
+};
+
+} // namespace MPU9250
+
+#endif  // MPU9250_FIXEDFILTER_H
@@ -0,0 +1,95 @@
+#ifndef MPU9250_FIXEDPOINT_H
+#define MPU9250_FIXEDPOINT_H
+#include <stdint.h>
+
+namespace MPU9250 {
+
+// Q8.24 fixed point: int32_t with 24 fractional bits, range +-128 and a
+// resolution of 6e-8. Unit quaternions, normalized vectors and body rates
+// in rad/s all fit, and a 1 kHz gyro step of a slow rotation (1e-6) is
+// still well resolved.
+using q24_t = int32_t;
+
+constexpr q24_t Q24_ONE {(q24_t)1 << 24};
+
+constexpr q24_t to_q24(float x) {
+	return (q24_t)(x * (float)Q24_ONE + (x < 0.f ? -0.5f : 0.5f));
+}
+
+inline float from_q24(q24_t x) {
+	return (float)x * (1.f / (float)Q24_ONE);
+}
+
+// AVR and Cortex-M0+ have no 32 x 32 -> 64 bit multiply, a 64 bit product
+// there is a library call. Four 16 x 16 -> 32 bit products are cheaper,
+// and within 1 LSB.
+#if defined(__AVR__) || defined(__ARM_ARCH_6M__)
+#define MPU9250_Q24_SPLIT_MUL
+#endif
+
+inline q24_t q24_mul(q24_t a, q24_t b) {
+#if defined(MPU9250_Q24_SPLIT_MUL)
+	const int16_t ah = (int16_t)(a >> 16), bh = (int16_t)(b >> 16);
+	const uint16_t al = (uint16_t)a, bl = (uint16_t)b;
+	// cross terms and low part at 2^-7 LSB, so that the sum does not
+	// overflow and the rounding stays unbiased
+	const int32_t mid = (((int32_t)ah * bl) >> 1) + (((int32_t)al * bh) >> 1)
+	                  + (int32_t)(((uint32_t)al * bl) >> 17);
+	return (int32_t)ah * bh * 256 + ((mid + 64) >> 7);
+#else
+	return (q24_t)(((int64_t)a * b + ((int64_t)1 << 23)) >> 24);
+#endif
+}
+
+inline uint8_t leading_zeros32(uint32_t x) {
+	return __builtin_clzl(x) - (sizeof(unsigned long) * 8 - 32);
+}
+
+// 1 / sqrt(x) for x > 2^-14, so that the result fits
+inline q24_t q24_inv_sqrt(q24_t x) {
+	// x = x' 4^k with x' in [1, 4)
+	const int8_t k = ((int8_t)(31 - leading_zeros32((uint32_t)x)) - 24) >> 1;
+	const q24_t xn = k >= 0 ? x >> (2 * k) : x << (-2 * k);
+	// quadratic through 1, 2.5 and 4 (4 % error), then three Newton steps
+	constexpr q24_t c0 {to_q24(1.37563f)}, c1 {to_q24(-0.42787f)}, c2 {to_q24(0.05224f)};
+	constexpr q24_t three_halves {to_q24(1.5f)};
+	q24_t y = c0 + q24_mul(xn, c1 + q24_mul(xn, c2));
+	for (uint8_t i = 0; i < 3; ++i)
+		y = q24_mul(y, three_halves - (q24_mul(xn, q24_mul(y, y)) >> 1));
+	return k >= 0 ? y >> k : y << -k;
+}
+
+inline q24_t q24_sqrt(q24_t x) {
+	if (x <= 0)
+		return 0;
+	// below 1, scale up by 4^k first to keep q24_inv_sqrt() in range
+	const uint8_t lz = leading_zeros32((uint32_t)x);
+	const uint8_t k = lz > 7 ? (lz - 6) >> 1 : 0;
+	const q24_t xs = x << (2 * k);
+	return q24_mul(xs, q24_inv_sqrt(xs)) >> k;
+}
+
+// Scales v (n <= 4 elements of any magnitude) to unit length.
+// Returns false, leaving v as is, for the zero vector.
+inline bool q24_normalize(q24_t* v, uint8_t n) {
+	uint32_t bits = 0;
+	for (uint8_t i = 0; i < n; ++i)
+		bits |= v[i] < 0 ? 0u - (uint32_t)v[i] : (uint32_t)v[i];
+	if (bits == 0)
+		return false;
+	// largest element into [0.5, 1) first, so the squares neither overflow nor vanish
+	const int8_t shift = (int8_t)leading_zeros32(bits) - 8;
+	q24_t sum = 0;
+	for (uint8_t i = 0; i < n; ++i) {
+		v[i] = shift >= 0 ? (q24_t)((uint32_t)v[i] << shift) : v[i] >> -shift;
+		sum += q24_mul(v[i], v[i]);
+	}
+	const q24_t r = q24_inv_sqrt(sum);
+	for (uint8_t i = 0; i < n; ++i)
+		v[i] = q24_mul(v[i], r);
+	return true;
+}
+
+} // namespace MPU9250
+
+#endif  // MPU9250_FIXEDPOINT_H
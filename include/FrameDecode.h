@@ -0,0 +1,42 @@
+#ifndef MPU9250_FRAMEDECODE_H
+#define MPU9250_FRAMEDECODE_H
+#include <stddef.h>
+#include <stdint.h>
+
+namespace MPU9250 {
+
+// Batch decoding of sensor data, which is big-endian int16 in the registers
+// and the FIFO. On hosts with SIMD (AVX2, SSE2 or NEON, whatever the
+// compiler targets) whole buffers are byte swapped, converted and scaled
+// 8 values at a time, otherwise a plain loop does the same. Both give
+// identical results. Define MPU9250_NO_SIMD to always use the loop.
+#if !defined(MPU9250_NO_SIMD)
+#if defined(__AVX2__)
+#define MPU9250_DECODE_AVX2
+#elif defined(__SSE2__)
+#define MPU9250_DECODE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MPU9250_DECODE_NEON
+#endif
+#endif
+
+// ax, ay, az, temp, gx, gy, gz
+constexpr uint8_t DECODE_FRAME_WORDS {7};
+
+// n values from src to host order, dest may be src
+void decode_be16(const uint8_t* src, size_t n, int16_t* dest);
+
+// n_frames contiguous frames of DECODE_FRAME_WORDS values to
+// dest[i * 7 + j] = value * scale[j] + offset[j]. dest may hold src in
+// its upper half (src == (const uint8_t*)dest + 14 * n_frames), so that
+// frames can be read and decoded in one buffer.
+void decode_frames(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest);
+// the same without SIMD, as reference
+void decode_frames_scalar(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest);
+
+// "avx2", "sse2", "neon" or "scalar"
+const char* decode_kernel();
+
+} // namespace MPU9250
+
+#endif  // MPU9250_FRAMEDECODE_H
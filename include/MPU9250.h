@@ -1,5 +1,6 @@
 #ifndef MPU9250_H
 #define MPU9250_H
+#include <FixedPoint.h>
 #include <MPU9250RegisterMap.h>
 #include <QuaternionFilter.h>
 #include <stdint.h>
@@ -11,6 +12,45 @@ public:
 	virtual void write(uint8_t address, const uint8_t *data, int length) =0;
 	virtual void read(uint8_t address, uint8_t *data, int length) =0;
 	virtual void delay(uint32_t milli_seconds) =0;
+
+	// Register read: write wlength bytes (the register), then read rlength.
+	// A bus that can do it overrides this with one transfer and a repeated
+	// start, so no other master gets in between and the stop, start and
+	// address byte in the middle are saved.
+	virtual void write_read(uint8_t address, const uint8_t* wdata, int wlength, uint8_t* rdata, int rlength) {
+		write(address, wdata, wlength);
+		read(address, rdata, rlength);
+	}
+
+	// Optional data ready notification from the INT pin. A driver wired to
+	// the pin (e.g. an edge triggered ISR setting a flag) returns true from
+	// has_interrupt(). wait_interrupt() then blocks until the pin fired or
+	// timeout_ms passed, consumes the event and returns whether it fired.
+	virtual bool has_interrupt() { return false; }
+	virtual bool wait_interrupt(uint32_t /* timeout_ms */) { return false; }
+
+	// Optional monotonic clock in microseconds, wrapping at 2^32. Without it
+	// samples are timestamped in sensor time (one ODR period per sample),
+	// which assumes no sample is missed between two polled reads.
+	// FIFO frames always use sensor time.
+	virtual bool has_clock() { return false; }
+	virtual uint32_t micros() { return 0; }
+
+	// Largest read in one transaction [bytes], 0 if there is no limit (e.g.
+	// 32 for the buffer of Arduino's Wire). Longer reads, such as draining
+	// the FIFO, are split into several transactions.
+	virtual uint16_t max_read_size() { return 0; }
+};
+
+// Driver with non-blocking register reads (DMA or interrupt driven I2C/SPI).
+// submit_read() starts reading length bytes from reg into data and returns
+// immediately, false if the transfer could not be started. The buffer must
+// stay valid until transfer_done() returns true. No other transfer is
+// issued by MPU while one is in flight. See BasicMPU::updateAsync().
+class AsyncDriver : public Driver {
+public:
+	virtual bool submit_read(uint8_t address, uint8_t reg, uint8_t* data, int length) =0;
+	virtual bool transfer_done() =0;
 };
 
 constexpr uint8_t MPU9250_WHOAMI_DEFAULT_VALUE {0x71};
@@ -78,6 +118,20 @@ struct Setting {
 	GYRO_DLPF_CFG     gyro_dlpf_cfg     {GYRO_DLPF_CFG::DLPF_41HZ};
 	uint8_t           accel_fchoice     {0x01};
 	ACCEL_DLPF_CFG    accel_dlpf_cfg    {ACCEL_DLPF_CFG::DLPF_45HZ};
+	// read the magnetometer through the MPU's auxiliary I2C master instead
+	// of bypass mode, so that it arrives together with accel/gyro data
+	bool              mag_via_i2c_master {false};
+};
+
+// Calibration of one device, as kept by MPU (see getCalibration()). Store
+// it (e.g. in EEPROM) and hand it to setup() to skip recalibrating and the
+// fuse ROM read on the next boot.
+struct Calibration {
+	float acc_bias[3] {0.f, 0.f, 0.f};          // in ACCEL_FS_SEL: 2g counts
+	float gyro_bias[3] {0.f, 0.f, 0.f};         // in GYRO_FS_SEL: 250dps counts
+	float mag_bias[3] {0.f, 0.f, 0.f};          // [mG]
+	float mag_scale[3] {1.f, 1.f, 1.f};
+	float mag_bias_factory[3] {1.f, 1.f, 1.f};  // AK8963 sensitivity adjustment
 };
 
 enum class Error : uint8_t {
@@ -86,14 +140,69 @@ enum class Error : uint8_t {
 	CONNECTION_MPU,  // mpu not connected
 	CONNECTION_MAG,  // magnetometer not connected
 	CONNECTION,      // mpu or magnetometer not connected
+	STATE,           // state blob corrupt or of another version
+	TIMEOUT,         // device not ready in time (warm start)
+};
+
+// One raw IMU frame, as read from the device.
+struct Sample {
+	static constexpr uint8_t MAG_VALID {0x01};  // mag holds a new reading
+
+	uint32_t timestamp;    // [us], sensor time or Driver::micros(), see Driver
+	int16_t acc[3];        // raw counts
+	int16_t gyro[3];
+	int16_t mag[3];        // last magnetometer reading
+	int16_t temperature;
+	uint8_t flags;
+};
+
+// Sample converted to physical units with the current resolutions and biases.
+struct ScaledSample {
+	uint32_t timestamp;  // [us]
+	float acc[3];        // [g]
+	float gyro[3];       // [deg/s]
+	float mag[3];        // [mG]
+	float temperature;   // [degC]
 };
 
-class MPU {
+template <typename FilterT, typename DriverT>
+class BasicMPUArray;
+// opt-in features, only pointed to here (FixedFilter.h, SampleQueue.h,
+// OnlineCalibration.h)
+class FixedFilter;
+template <typename T>
+class SPSCQueue;
+class MagCalibrator;
+class GyroBiasEstimator;
+
+// The filter and driver types are template parameters so that a concrete
+// (final) filter and driver can be inlined into the per-sample path.
+// MPU uses the abstract base classes and dispatches at runtime.
+//
+// MPU and AsyncMPU are compiled once, in MPU9250.cpp. For other filter or
+// driver types include MPU9250Impl.h, which holds the member definitions.
+template <typename FilterT = Filter, typename DriverT = Driver>
+class BasicMPU {
 public:
 	static constexpr uint16_t CALIB_GYRO_SENSITIVITY {131};     // LSB/degrees/sec
 	static constexpr uint16_t CALIB_ACCEL_SENSITIVITY {16384};  // LSB/g
+	static constexpr uint16_t CALIB_SAMPLES {1000};             // default accel/gyro window, at 1 kHz
+	static constexpr uint8_t CALIB_BURST_FRAMES {24};           // 12 byte FIFO frames read per burst
+	static constexpr uint16_t CALIB_TIMEOUT_MARGIN_MS {100};    // added to 4x the window before giving up
+
+	// FIFO frame: accel xyz, temperature, gyro xyz (big endian, in register order)
+	// followed by AK8963 ST1..ST2 when the magnetometer is read by the I2C master
+	static constexpr uint16_t FIFO_SIZE {512};          // bytes
+	static constexpr uint8_t FIFO_FRAME_SIZE {14};      // bytes per frame
+	static constexpr uint8_t FIFO_FRAME_WORDS {7};      // int16_t per decoded frame
+	static constexpr uint8_t FIFO_MAG_FRAME_SIZE {22};  // bytes per frame, with magnetometer
+	static constexpr uint8_t FIFO_MAG_FRAME_WORDS {11}; // int16_t per decoded frame, with magnetometer
+	static constexpr uint16_t FIFO_BUFFER_WORDS {FIFO_SIZE / 2};  // int16_t holding a full FIFO, decoded
 
 private:
+	// schedules the bus access of several devices
+	friend class BasicMPUArray<FilterT, DriverT>;
+
 	// Device address when AD0 = 0
 	static constexpr uint8_t MPU9250_DEFAULT_ADDRESS {0x68};
 	// magnetometer address
@@ -126,6 +235,19 @@ private:
 	// Self Test
 	float self_test_result[6] {0.f};  // holds results of gyro and accelerometer self test
 
+	// time of the latest sample and of the last filter update
+	uint32_t sample_period_us {0};
+	uint32_t sample_time_us {0};
+	uint32_t filter_time_us {0};
+	bool has_filter_time {false};
+	int16_t mag_count[3] {0, 0, 0};  // latest raw magnetometer reading
+	int16_t acc_gyro_count[7] {};    // latest raw accel, temperature, gyro
+
+	// raw counts to fixed point filter inputs, see update_fixed_scaling()
+	q24_t gyro_res_q24 {0};         // [rad/s] per LSB
+	int32_t mag_gain_q14[3] {};     // mag direction = count * gain - offset
+	int32_t mag_offset_q14[3] {};
+
 	// IMU Data
 	float a[3] {0.f, 0.f, 0.f};
 	float g[3] {0.f, 0.f, 0.f};
@@ -136,20 +258,76 @@ private:
 	float lin_acc[3] {0.f, 0.f, 0.f};
 
 	// filter
-	Filter* filter;
+	FilterT* filter {nullptr};
 	size_t n_filter_iter {1};
 
 	// Other settings
 	bool has_connected {false};
 	bool b_ahrs {true};
 	bool b_verbose {false};
+	bool b_fifo {false};
+
+	// async frame transfer
+	uint8_t async_buf[FIFO_MAG_FRAME_SIZE];
+	bool async_busy {false};
+
+	// Shadow of the configuration registers 0x13..0x38 and 0x67..0x7E, so
+	// that read-modify-write cycles and isSleeping() need no bus read. Data,
+	// status, FIFO and self clearing registers are never cached.
+	static constexpr uint8_t SHADOW_SIZE {62};
+	static constexpr uint8_t MAX_BURST_WRITE {8};
+	uint8_t shadow[SHADOW_SIZE];
+	uint8_t shadow_valid[(SHADOW_SIZE + 7) / 8] {};
+
+	// every sample read by update() / updateAsync(), for another context
+	SPSCQueue<Sample>* queue {nullptr};
+
+	// background magnetometer calibration, fed from apply_mag()
+	MagCalibrator* mag_calibrator {nullptr};
+	// background gyro bias tracking, fed from apply_accel_gyro()
+	GyroBiasEstimator* gyro_estimator {nullptr};
+	bool b_push_gyro_bias {false};
+
+	// warm start: poll readiness instead of fixed delays
+	bool b_warm_start {false};
+
+	// state blob: magic, version, payload size, payload, CRC-16 of the rest
+	static constexpr uint16_t STATE_MAGIC {0x9250};
+	static constexpr uint8_t STATE_HEADER_SIZE {4};
+	// Setting, Calibration, declination, quaternion, iterations, filter state size
+	static constexpr uint8_t STATE_FIXED_SIZE {9 + 15 * 4 + 4 + 4 * 4 + 2 + 1};
 
 	// platform functions
-	Driver* driver;
+	DriverT* driver {nullptr};
 
 public:
-	Error setup(uint8_t addr, Driver& w,
-              Filter& filter, const Setting& setting = Setting{});
+	Error setup(uint8_t addr, DriverT& w,
+              FilterT& filter, const Setting& setting = Setting{});
+	// Warm start: restores a stored calibration instead of reading the fuse
+	// ROM, and polls the reset and data ready bits instead of the fixed
+	// start-up delays. Returns once the device produces data, Error::TIMEOUT
+	// if it does not.
+	Error setup(uint8_t addr, DriverT& w, FilterT& filter,
+              const Calibration& calibration, const Setting& setting = Setting{});
+	void getCalibration(Calibration& calibration) const;
+	// Warm start from a blob written by exportState(), Error::STATE if it is
+	// invalid or holds an out of range Setting or 0 iterations (nothing is
+	// touched then).
+	Error setup(uint8_t addr, DriverT& w, FilterT& filter,
+              const uint8_t* state, size_t size);
+
+	// state
+	// Calibration, Setting, magnetic declination, quaternion, filter iterations
+	// and the filter state (Filter::save_state()) as one versioned, CRC-16
+	// protected little endian blob, to keep in any byte oriented storage.
+	static constexpr uint8_t STATE_VERSION {2};
+	static constexpr size_t STATE_SIZE {STATE_HEADER_SIZE + STATE_FIXED_SIZE + Filter::MAX_STATE_SIZE + 2};  // upper bound
+	// returns the number of bytes written, 0 if size is too small or the
+	// filter iterations do not fit 16 bits
+	size_t exportState(uint8_t* dest, size_t size) const;
+	// Re-initializes a set up device from the blob (a warm start, see setup()).
+	// Filter state that does not fit the current filter is dropped.
+	bool importState(const uint8_t* src, size_t size);
 
 	bool selftest() { return self_test_impl(); }
 	void verbose(const bool b) { b_verbose = b; }
@@ -169,22 +347,89 @@ public:
 		return read_byte(mpu_i2c_addr, PWR_MGMT_1) & PWR_MGMT_1_SLEEP;
 	}
 
+	// forget the cached register values, e.g. after the device lost power
+	void invalidateRegisterCache();
+
 	// calibration
-	void calibrateAccelGyro() { calibrate_acc_gyro_impl(); }
+	// averages n_samples at-rest samples (1 ms each), the device is reset.
+	// false if the sensor stopped delivering samples (the biases are kept)
+	// or did not come back from a reset
+	bool calibrateAccelGyro(uint16_t n_samples = CALIB_SAMPLES) { return calibrate_acc_gyro_impl(n_samples); }
 	void calibrateMag()       { calibrate_mag_impl(); }
+	// Feeds every new magnetometer reading to c, and takes over its bias and
+	// scale together whenever it has a new solution. Replaces calibrateMag()
+	// without blocking, nullptr detaches.
+	void attachMagCalibrator(MagCalibrator* c) { mag_calibrator = c; }
+	// Feeds every sample to e and removes its bias estimate from the gyro
+	// output. With push_to_device, whole offset register steps are moved
+	// into XG_OFFSET..ZG_OFFSET (one burst) and gyro bias, so that they are
+	// kept by getCalibration() / exportState(). nullptr detaches.
+	void attachGyroBiasEstimator(GyroBiasEstimator* e, bool push_to_device = false) {
+		gyro_estimator = e;
+		b_push_gyro_bias = push_to_device;
+	}
 
 	// filter
 	void setFilterIterations(const size_t n) { if (n > 0) n_filter_iter = n; }
 
-	// update
-	bool available() {
-		return has_connected && 
-			(read_byte(mpu_i2c_addr, INT_STATUS) & INT_STATUS_RAW_RDY);
+	// fifo
+	// In FIFO mode every sample taken at the configured ODR is queued by the
+	// device and update() drains all queued frames at once, so nothing is
+	// lost when the host loop stalls (as long as the FIFO does not overflow).
+	void enableFifo();
+	void disableFifo();
+	bool isFifoEnabled() const { return b_fifo; }
+	uint8_t fifoFrameWords() const {
+		return setting.mag_via_i2c_master ? FIFO_MAG_FRAME_WORDS : FIFO_FRAME_WORDS;
 	}
+	uint16_t fifoCount();
+	// Reads up to max_frames complete frames in a single FIFO_R_W burst.
+	// Each frame is decoded to fifoFrameWords() values: ax, ay, az, temp, gx, gy, gz
+	// (raw counts) and, with mag_via_i2c_master, mx, my, mz and Sample::MAG_VALID
+	// if the magnetometer had new data. Returns the number of frames read, 0 if
+	// the FIFO was empty or had overflowed (in which case it is reset).
+	size_t readFifo(int16_t* dest, size_t max_frames);
+	// Like readFifo(), but decodes the whole burst to physical units at once
+	// (SIMD where available, see FrameDecode.h): DECODE_FRAME_WORDS floats per
+	// frame, acc [g], temperature [degC] and gyro [deg/s], scaled like
+	// getAccX() etc. but without the bias of an attached GyroBiasEstimator.
+	// Magnetometer data in the frames is dropped.
+	size_t readFifoScaled(float* dest, size_t max_frames);
+
+	// batch
+	// Reads all pending frames (up to max) without running the filter.
+	// Drains the FIFO when it is enabled, otherwise reads at most one
+	// frame if new data is available. Returns the number of samples written.
+	size_t readBatch(Sample* out, size_t max);
+	void scaleBatch(const Sample* in, ScaledSample* out, size_t n) const;
+
+	// update
+	// With an interrupt capable driver these wait on the INT pin instead of
+	// polling INT_STATUS over the bus.
+	bool available() { return wait_available(0); }
 	void update_rpy(float qw, float qx, float qy, float qz);
 	void update_accel_gyro();
 	void update_mag();
 	bool update();
+	// blocks for up to timeout_ms until new data is ready
+	bool update(uint32_t timeout_ms);
+	// Non-blocking update, DriverT has to be an AsyncDriver. Each call collects
+	// a finished frame transfer, starts the next one if data is ready, and then
+	// runs the filter on the collected sample while the bus is busy. Returns
+	// true when a sample was processed. Register path only: with the FIFO
+	// enabled it is the same as update(). In bypass mode the magnetometer is
+	// still read synchronously, use mag_via_i2c_master to get it in the frame.
+	template <typename D = DriverT>
+	bool updateAsync();
+
+	// Every sample processed by update() / updateAsync() is also pushed, raw
+	// and timestamped, into q (the producer side), so that a consumer in
+	// another thread or task sees all of them, not only the latest.
+	// nullptr detaches.
+	void attachQueue(SPSCQueue<Sample>* q) { queue = q; }
+
+	// time of the latest sample [us], see Driver::has_clock()
+	uint32_t getTimestamp() const { return sample_time_us; }
 
 	float getRoll()  const { return rpy[0]; }
 	float getPitch() const { return rpy[1]; }
@@ -239,6 +484,7 @@ public:
 	float getMagScale(uint8_t i) const { return (i < 3) ? mag_scale[i] : 0.f; }
 	void setMagScale(float x, float y, float z) {
 		mag_scale[0] = x; mag_scale[1] = y; mag_scale[2] = z;
+		update_fixed_scaling();
 	}
 	float getMagScaleX() const { return mag_scale[0]; }
 	float getMagScaleY() const { return mag_scale[1]; }
@@ -246,6 +492,7 @@ public:
 	float getMagBias(uint8_t i) const { return (i < 3) ? mag_bias[i] : 0.f; }
 	void setMagBias(float x, float y, float z) {
 		mag_bias[0] = x; mag_bias[1] = y; mag_bias[2] = z;
+		update_fixed_scaling();
 	}
 	float getMagBiasX() const { return mag_bias[0]; }
 	float getMagBiasY() const { return mag_bias[1]; }
@@ -257,8 +504,18 @@ public:
 
 private:
 	// initialization
-	void initMPU9250();
-	void initAK8963();
+	Error setup_impl(uint8_t addr, DriverT& w, FilterT& filter,
+                   const Setting& setting, const Calibration* calibration);
+	Error init_devices(const Calibration* calibration);
+	// false if a warm start timed out polling the device
+	bool initMPU9250();
+	bool initAK8963();
+	void init_i2c_master();
+	void set_mag_polling(bool b);
+	bool wait_reset_done();
+	bool wait_mag_ready();
+	bool wait_first_sample();
+	bool check_state(const uint8_t* src, size_t size) const;
 	// Accelerometer and gyroscope self test; check calibration wrt
 	// factory settings
 	// Should return percent deviation from factory trim values,
@@ -266,7 +523,27 @@ private:
 	bool self_test_impl();
 
 	void read_accel_gyro(int16_t* destination);
+	void decode_accel_gyro(const uint8_t* raw_data, int16_t* destination) const;
+	bool read_frame(int16_t* raw_acc_gyro_data);
+	void apply_accel_gyro(const int16_t* raw_acc_gyro_data);
+	void apply_mag(const int16_t* mag_count);
+	void scale_accel_gyro(const int16_t* raw_acc_gyro_data, float* acc, float* gyro, float* temp) const;
+	void scale_mag(const int16_t* mag_count, float* mag) const;
+	void to_sample(const int16_t* raw_acc_gyro_data, Sample& sample);
+	void fill_sample(const int16_t* raw_acc_gyro_data, Sample& sample) const;
+	void enqueue(const int16_t* raw_acc_gyro_data, uint8_t flags);
+	void stamp_sample();
+	bool wait_available(uint32_t timeout_ms);
+	bool update_sample();
+	void update_filter();
+	template <typename F> void run_filter(F* f, const Filter*, uint32_t dt_us);
+	template <typename F> void run_filter(F* f, const FixedFilter*, uint32_t dt_us);
+	void update_fixed_scaling();
+	void update_output();
+	bool update_fifo();
+	void reset_fifo();
 	bool read_mag(int16_t* destination);
+	bool decode_mag(const uint8_t* raw_data, int16_t* destination) const;
 	int16_t read_temperature_data();
 
 	// Function which accumulates gyro and accelerometer data after device
@@ -275,11 +552,12 @@ private:
 	// bias registers.
 	// ACCEL_FS_SEL: 2g (maximum sensitivity)
 	// GYRO_FS_SEL: 250dps (maximum sensitivity)
-	void calibrate_acc_gyro_impl();
-	void set_acc_gyro_to_calibration();
-	void collect_acc_gyro_data_to(float* a_bias, float* g_bias);
+	bool calibrate_acc_gyro_impl(uint16_t n_samples);
+	bool set_acc_gyro_to_calibration();
+	bool collect_acc_gyro_data_to(float* a_bias, float* g_bias, uint16_t n_samples);
 	void write_accel_offset();
 	void write_gyro_offset();
+	void correct_gyro_bias();
 	// mag calibration is executed in MAG_OUTPUT_BITS: 16BITS
 	void calibrate_mag_impl();
 	void collect_mag_data_to(float* m_bias, float* m_scale);
@@ -288,14 +566,38 @@ private:
 	float get_acc_resolution(ACCEL_FS_SEL accel_af_sel) const; 
 	float get_gyro_resolution(GYRO_FS_SEL gyro_fs_sel) const;
 	float get_mag_resolution(MAG_OUTPUT_BITS mag_output_bits) const;
+	uint32_t get_sample_period_us() const;
 
 	void write_byte(uint8_t address, uint8_t reg, uint8_t data);
+	// consecutive registers, in transactions of up to MAX_BURST_WRITE
+	void write_bytes(uint8_t address, uint8_t reg,
+                   uint8_t count, const uint8_t* data);
+	// MPU register read-modify-write, served from the shadow when possible
+	void modify_byte(uint8_t reg, uint8_t clear_bits, uint8_t set_bits);
 	uint8_t read_byte(uint8_t address, uint8_t reg);
 	void read_bytes(uint8_t address, uint8_t reg,
-                  uint8_t count, uint8_t* dest);
+                  uint16_t count, uint8_t* dest);
+
+	int8_t shadow_index(uint8_t reg) const;
+	void shadow_store(uint8_t reg, uint8_t data);
+	void shadow_after_reset();
 	void print_i2c_error();
+
+	// AK8963 access, direct in bypass mode or through I2C_SLV4 of the I2C master
+	void mag_write_byte(uint8_t reg, uint8_t data);
+	uint8_t mag_read_byte(uint8_t reg);
+	void mag_read_bytes(uint8_t reg, uint8_t count, uint8_t* dest);
+	bool wait_slv4_done();
 };
 
+using MPU = BasicMPU<>;
+using AsyncMPU = BasicMPU<Filter, AsyncDriver>;
+
+// compiled in MPU9250.cpp
+extern template class BasicMPU<Filter, Driver>;
+extern template class BasicMPU<Filter, AsyncDriver>;
+extern template bool BasicMPU<Filter, AsyncDriver>::updateAsync<AsyncDriver>();
+
 } // namespace MPU9250
 
 #endif  // MPU9250_H
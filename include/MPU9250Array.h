@@ -0,0 +1,145 @@
+#ifndef MPU9250ARRAY_H
+#define MPU9250ARRAY_H
+#include <MPU9250.h>
+
+namespace MPU9250 {
+
+// Several MPU9250 on one Driver (AD0 low/high, or behind address translation),
+// updated together. The devices are set up individually, each with its own
+// filter instance, and then added to the array, which owns the polling.
+//
+// Every AK8963 answers at the same address, so with more than one device the
+// magnetometers must be read through the I2C master of their MPU9250
+// (Setting::mag_via_i2c_master), in bypass mode they would all sit on the
+// host bus. add() refuses such a device.
+template <typename FilterT = Filter, typename DriverT = Driver>
+class BasicMPUArray {
+public:
+	using Device = BasicMPU<FilterT, DriverT>;
+
+	static constexpr uint8_t MAX_DEVICES {8};
+
+	enum class Schedule : uint8_t {
+		// poll every device once per update(), update those with new data
+		ROUND_ROBIN,
+		// poll only the first device (its INT pin with an interrupt driver), and
+		// when it has data read all devices back to back. All devices must run
+		// at the same ODR. Saves a status read per additional device per sample.
+		ALIGNED,
+	};
+
+	bool add(Device& mpu);
+	uint8_t size() const { return n_devices; }
+	Device& operator[](uint8_t i) { return *devices[i]; }
+	const Device& operator[](uint8_t i) const { return *devices[i]; }
+
+	void schedule(Schedule s) { sched = s; }
+
+	// returns a bitmask of the devices updated in this round
+	uint8_t update();
+	bool isUpdated(uint8_t i) const { return updated & (1 << i); }
+	// common time of the round [us]: the first updated device's sample time
+	uint32_t getTimestamp() const { return round_time_us; }
+
+	// mean of acc [g] and gyro [deg/s] over the devices updated in the last
+	// round, for redundant IMUs mounted with the same orientation
+	bool getMean(float* acc, float* gyro) const;
+
+private:
+	Device* devices[MAX_DEVICES] {};
+	uint8_t n_devices {0};
+	uint8_t next {0};  // first device polled in the next round
+	uint8_t updated {0};
+	uint32_t round_time_us {0};
+	Schedule sched {Schedule::ROUND_ROBIN};
+
+	bool data_ready(Device& mpu);
+};
+
+template <typename FilterT, typename DriverT>
+bool BasicMPUArray<FilterT, DriverT>::add(Device& mpu) {
+	if (n_devices >= MAX_DEVICES || !mpu.has_connected)
+		return false;
+	if (n_devices > 0) {
+		if (mpu.driver != devices[0]->driver)
+			return false;
+		// a second AK8963 on the host bus would collide with the first one
+		if (!mpu.setting.mag_via_i2c_master || !devices[0]->setting.mag_via_i2c_master)
+			return false;
+	}
+	devices[n_devices++] = &mpu;
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPUArray<FilterT, DriverT>::data_ready(Device& mpu) {
+	// the FIFO is checked through its count when draining
+	if (mpu.b_fifo)
+		return true;
+	// an INT pin on a shared driver cannot tell the devices apart, poll the bus
+	return mpu.read_byte(mpu.mpu_i2c_addr, INT_STATUS) & INT_STATUS_RAW_RDY;
+}
+
+template <typename FilterT, typename DriverT>
+uint8_t BasicMPUArray<FilterT, DriverT>::update() {
+	updated = 0;
+	if (n_devices == 0)
+		return 0;
+
+	if (sched == Schedule::ALIGNED) {
+		if (!devices[0]->available())
+			return 0;
+		for (uint8_t i = 0; i < n_devices; ++i) {
+			if (devices[i]->update_sample())
+				updated |= 1 << i;
+		}
+		if (updated & 1)
+			round_time_us = devices[0]->sample_time_us;
+		return updated;
+	}
+
+	// rotate the start so that no device always sees the longest latency
+	bool has_time = false;
+	for (uint8_t k = 0; k < n_devices; ++k) {
+		uint8_t i = (next + k) % n_devices;
+		Device& mpu = *devices[i];
+		if (!data_ready(mpu) || !mpu.update_sample())
+			continue;
+		updated |= 1 << i;
+		if (!has_time) {
+			round_time_us = mpu.sample_time_us;
+			has_time = true;
+		}
+	}
+	next = (next + 1) % n_devices;
+	return updated;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPUArray<FilterT, DriverT>::getMean(float* acc, float* gyro) const {
+	uint8_t n = 0;
+	for (uint8_t j = 0; j < 3; ++j)
+		acc[j] = gyro[j] = 0.f;
+	for (uint8_t i = 0; i < n_devices; ++i) {
+		if (!isUpdated(i))
+			continue;
+		for (uint8_t j = 0; j < 3; ++j) {
+			acc[j] += devices[i]->a[j];
+			gyro[j] += devices[i]->g[j];
+		}
+		++n;
+	}
+	if (n == 0)
+		return false;
+	for (uint8_t j = 0; j < 3; ++j) {
+		acc[j] /= n;
+		gyro[j] /= n;
+	}
+	return true;
+}
+
+using MPUArray = BasicMPUArray<>;
+
+} // namespace MPU9250
+
+#endif  // MPU9250ARRAY_H
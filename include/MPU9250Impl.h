@@ -0,0 +1,1677 @@
+#ifndef MPU9250IMPL_H
+#define MPU9250IMPL_H
+#include <MPU9250.h>
+#include <MPU9250RegisterMap.h>
+#include <AK8963RegisterMap.h>
+#include <MPU9250Utility.h>
+#include <FixedFilter.h>
+#include <FrameDecode.h>
+#include <OnlineCalibration.h>
+#include <SampleQueue.h>
+
+// Member definitions of BasicMPU. MPU9250.cpp compiles MPU and AsyncMPU from
+// them, include this header only for other filter or driver types.
+
+namespace MPU9250 {
+
+template <typename FilterT, typename DriverT>
+Error BasicMPU<FilterT, DriverT>::setup(uint8_t addr, DriverT& w,
+                                        FilterT& filter, const Setting& setting)
+{
+	return setup_impl(addr, w, filter, setting, nullptr);
+}
+
+template <typename FilterT, typename DriverT>
+Error BasicMPU<FilterT, DriverT>::setup(uint8_t addr, DriverT& w, FilterT& filter,
+                                        const Calibration& calibration, const Setting& setting)
+{
+	return setup_impl(addr, w, filter, setting, &calibration);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::getCalibration(Calibration& calibration) const {
+	for (uint8_t i = 0; i < 3; ++i) {
+		calibration.acc_bias[i] = acc_bias[i];
+		calibration.gyro_bias[i] = gyro_bias[i];
+		calibration.mag_bias[i] = mag_bias[i];
+		calibration.mag_scale[i] = mag_scale[i];
+		calibration.mag_bias_factory[i] = mag_bias_factory[i];
+	}
+}
+
+template <typename FilterT, typename DriverT>
+Error BasicMPU<FilterT, DriverT>::setup(uint8_t addr, DriverT& w, FilterT& filter,
+                                        const uint8_t* state, size_t size)
+{
+	if (!check_state(state, size))
+		return Error::STATE;
+
+	const uint8_t* p = state + STATE_HEADER_SIZE;
+	Setting s;
+	s.accel_fs_sel = static_cast<ACCEL_FS_SEL>(*p++);
+	s.gyro_fs_sel = static_cast<GYRO_FS_SEL>(*p++);
+	s.mag_output_bits = static_cast<MAG_OUTPUT_BITS>(*p++);
+	s.fifo_sample_rate = static_cast<FIFO_SAMPLE_RATE>(*p++);
+	s.gyro_fchoice = *p++;
+	s.gyro_dlpf_cfg = static_cast<GYRO_DLPF_CFG>(*p++);
+	s.accel_fchoice = *p++;
+	s.accel_dlpf_cfg = static_cast<ACCEL_DLPF_CFG>(*p++);
+	s.mag_via_i2c_master = *p++;
+	Calibration c;
+	for (uint8_t i = 0; i < 3; ++i) p = get_f32(p, c.acc_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = get_f32(p, c.gyro_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = get_f32(p, c.mag_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = get_f32(p, c.mag_scale[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = get_f32(p, c.mag_bias_factory[i]);
+
+	Error e = setup_impl(addr, w, filter, s, &c);
+	if (e != Error::NONE)
+		return e;
+
+	p = get_f32(p, magnetic_declination);
+	for (uint8_t i = 0; i < 4; ++i) p = get_f32(p, q[i]);
+	uint16_t n_iter;
+	p = get_u16(p, n_iter);
+	n_filter_iter = n_iter;
+	uint8_t filter_size = *p++;
+	filter.load_state(p, filter_size);
+	update_rpy(q[0], q[1], q[2], q[3]);
+	return Error::NONE;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::check_state(const uint8_t* src, size_t size) const {
+	if (size < STATE_HEADER_SIZE + STATE_FIXED_SIZE + 2)
+		return false;
+	uint16_t magic, crc;
+	get_u16(src, magic);
+	uint8_t payload_size = src[3];
+	if (magic != STATE_MAGIC || src[2] != STATE_VERSION)
+		return false;
+	if (payload_size < STATE_FIXED_SIZE || size < (size_t)STATE_HEADER_SIZE + payload_size + 2)
+		return false;
+	// the filter state size is the last fixed field
+	uint8_t filter_size = src[STATE_HEADER_SIZE + STATE_FIXED_SIZE - 1];
+	if (filter_size > Filter::MAX_STATE_SIZE || payload_size != STATE_FIXED_SIZE + filter_size)
+		return false;
+	get_u16(src + STATE_HEADER_SIZE + payload_size, crc);
+	if (crc != crc16_ccitt(src, STATE_HEADER_SIZE + payload_size))
+		return false;
+	// Setting, in the order of exportState()
+	const uint8_t* s = src + STATE_HEADER_SIZE;
+	if (s[0] > static_cast<uint8_t>(ACCEL_FS_SEL::A16G) ||
+	    s[1] > static_cast<uint8_t>(GYRO_FS_SEL::G2000DPS) ||
+	    s[2] > static_cast<uint8_t>(MAG_OUTPUT_BITS::M16BITS) ||
+	    s[3] > static_cast<uint8_t>(FIFO_SAMPLE_RATE::SMPL_125HZ) ||
+	    s[4] > 0x03 ||  // gyro_fchoice, 2 bits
+	    s[5] > static_cast<uint8_t>(GYRO_DLPF_CFG::DLPF_3600HZ) ||
+	    s[6] > 0x01 ||  // accel_fchoice
+	    s[7] > static_cast<uint8_t>(ACCEL_DLPF_CFG::DLPF_420HZ) ||
+	    s[8] > 0x01)    // mag_via_i2c_master
+		return false;
+	// filter iterations, update_filter() divides dt by them
+	uint16_t n_iter;
+	get_u16(src + STATE_HEADER_SIZE + STATE_FIXED_SIZE - 3, n_iter);
+	return n_iter != 0;
+}
+
+template <typename FilterT, typename DriverT>
+size_t BasicMPU<FilterT, DriverT>::exportState(uint8_t* dest, size_t size) const {
+	uint8_t filter_state[Filter::MAX_STATE_SIZE];
+	uint8_t filter_size = filter ? filter->save_state(filter_state) : 0;
+	uint8_t payload_size = STATE_FIXED_SIZE + filter_size;
+	size_t total = STATE_HEADER_SIZE + payload_size + 2;
+	if (size < total || n_filter_iter > 0xFFFF)
+		return 0;
+
+	uint8_t* p = put_u16(dest, STATE_MAGIC);
+	*p++ = STATE_VERSION;
+	*p++ = payload_size;
+	*p++ = static_cast<uint8_t>(setting.accel_fs_sel);
+	*p++ = static_cast<uint8_t>(setting.gyro_fs_sel);
+	*p++ = static_cast<uint8_t>(setting.mag_output_bits);
+	*p++ = static_cast<uint8_t>(setting.fifo_sample_rate);
+	*p++ = setting.gyro_fchoice;
+	*p++ = static_cast<uint8_t>(setting.gyro_dlpf_cfg);
+	*p++ = setting.accel_fchoice;
+	*p++ = static_cast<uint8_t>(setting.accel_dlpf_cfg);
+	*p++ = setting.mag_via_i2c_master;
+	for (uint8_t i = 0; i < 3; ++i) p = put_f32(p, acc_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = put_f32(p, gyro_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = put_f32(p, mag_bias[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = put_f32(p, mag_scale[i]);
+	for (uint8_t i = 0; i < 3; ++i) p = put_f32(p, mag_bias_factory[i]);
+	p = put_f32(p, magnetic_declination);
+	for (uint8_t i = 0; i < 4; ++i) p = put_f32(p, q[i]);
+	p = put_u16(p, (uint16_t)n_filter_iter);
+	*p++ = filter_size;
+	memcpy(p, filter_state, filter_size);
+	p += filter_size;
+	put_u16(p, crc16_ccitt(dest, STATE_HEADER_SIZE + payload_size));
+	return total;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::importState(const uint8_t* src, size_t size) {
+	if (!has_connected)
+		return false;
+	return setup(mpu_i2c_addr, *driver, *filter, src, size) == Error::NONE;
+}
+
+template <typename FilterT, typename DriverT>
+Error BasicMPU<FilterT, DriverT>::setup_impl(uint8_t addr, DriverT& w, FilterT& filter,
+                                             const Setting& setting, const Calibration* calibration)
+{
+	// addr should be valid for MPU
+	if ((addr < MPU9250_DEFAULT_ADDRESS) || (addr > MPU9250_DEFAULT_ADDRESS + 7))
+		return Error::I2C_ADDRESS;
+
+	mpu_i2c_addr = addr;
+	this->setting = setting;
+	driver = &w;
+	this->filter = &filter;
+
+	acc_resolution = get_acc_resolution(setting.accel_fs_sel);
+	gyro_resolution = get_gyro_resolution(setting.gyro_fs_sel);
+	mag_resolution = get_mag_resolution(setting.mag_output_bits);
+	sample_period_us = get_sample_period_us();
+	has_filter_time = false;
+
+	b_warm_start = (calibration != nullptr);
+	const Error e = init_devices(calibration);
+	// only setup() polls, later re-initializations (calibrateMag()) take the fixed delays
+	b_warm_start = false;
+	if (e != Error::NONE)
+		return e;
+
+	update_fixed_scaling();
+	has_connected = true;
+	return Error::NONE;
+}
+
+template <typename FilterT, typename DriverT>
+Error BasicMPU<FilterT, DriverT>::init_devices(const Calibration* calibration) {
+	if (b_warm_start) {
+		for (uint8_t i = 0; i < 3; ++i)
+			mag_bias_factory[i] = calibration->mag_bias_factory[i];
+	}
+
+	if (!isConnectedMPU9250())
+		return Error::CONNECTION_MPU;
+	if (!initMPU9250())
+		return Error::TIMEOUT;
+
+	if(!isConnectedAK8963())
+		return Error::CONNECTION_MAG;
+	if (!initAK8963())
+		return Error::TIMEOUT;
+
+	if (b_warm_start) {
+		for (uint8_t i = 0; i < 3; ++i) {
+			acc_bias[i] = calibration->acc_bias[i];
+			gyro_bias[i] = calibration->gyro_bias[i];
+			mag_bias[i] = calibration->mag_bias[i];
+			mag_scale[i] = calibration->mag_scale[i];
+		}
+		write_accel_offset();
+		write_gyro_offset();
+		if (!wait_first_sample())
+			return Error::TIMEOUT;
+	}
+	return Error::NONE;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::isConnectedMPU9250() {
+	uint8_t c = read_byte(mpu_i2c_addr, WHO_AM_I_MPU9250);
+	return (c == MPU9250_WHOAMI_DEFAULT_VALUE) ||
+         (c == MPU9255_WHOAMI_DEFAULT_VALUE) ||
+         (c == MPU6500_WHOAMI_DEFAULT_VALUE);
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::isConnectedAK8963() {
+	uint8_t c = mag_read_byte(AK8963_WHO_AM_I);
+	return (c == AK8963_WHOAMI_DEFAULT_VALUE);
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::initMPU9250() {
+	// reset device
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, PWR_MGMT_1_H_RESET);
+	if (b_warm_start) {
+		if (!wait_reset_done())
+			return false;
+	} else {
+		driver->delay(100);
+	}
+
+	// wake up device
+	// Clear sleep mode, enable all sensors, wait for all registers to reset
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, 0x00);
+	if (!b_warm_start)
+		driver->delay(100);
+
+	// get stable time source
+	// Auto select clock source to be PLL
+	// (a warm start waits for the first data ready instead, see setup())
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, PWR_MGMT_1_CLKSEL(1));
+	if (!b_warm_start)
+		driver->delay(200);
+
+	// Configure Gyro and Thermometer
+	// Disable FSYNC and set thermometer and gyro bandwidth to 41 and 42 Hz, respectively;
+	// minimum delay time for this setting is 5.9 ms, which means sensor fusion update rates cannot
+	// be higher than 1 / 0.0059 = 170 Hz
+	// GYRO_DLPF_CFG = bits 2:0 = 011; this limits the sample rate to 1000 Hz for both
+	// With the MPU9250, it is possible to get gyro sample rates of 32 kHz (!), 8 kHz, or 1 kHz
+	// SMPLRT_DIV, CONFIG, GYRO_CONFIG, ACCEL_CONFIG and ACCEL_CONFIG2 are
+	// consecutive and written in one burst, the previous GYRO_CONFIG,
+	// ACCEL_CONFIG and ACCEL_CONFIG2 values come from the shadow (known after reset)
+	uint8_t config[5];
+
+	// Set sample rate = gyroscope output rate/(1 + SMPLRT_DIV)
+	// Use a 200 Hz rate when running at 1kHZ
+	config[0] = (uint8_t)setting.fifo_sample_rate;
+	config[1] = (uint8_t)setting.gyro_dlpf_cfg;
+
+	// Set gyroscope full scale range and fchoice_b
+	uint8_t c = read_byte(mpu_i2c_addr, GYRO_CONFIG);
+	// Clear self-test bits [7:5], GYRO_FS_SEL bits [4:3] and Fchoice bits [1:0]
+	// thus the only bit we don't clear is bit 3 (a reserved bit)
+	c &= (1 << 3);
+	c |= GYRO_CONFIG_FS_SEL(uint8_t(setting.gyro_fs_sel));
+	c |= GYRO_CONFIG_Fchoice_b(uint8_t(~setting.gyro_fchoice));
+	config[2] = c;
+
+	// Set accelerometer full-scale range configuration
+	// first clear self-test and fs select bits
+	// then write fs select
+	c = read_byte(mpu_i2c_addr, ACCEL_CONFIG);
+	c &= ~(ACCEL_CONFIG_ax_st_en | ACCEL_CONFIG_ay_st_en | ACCEL_CONFIG_az_st_en);
+	c &= ~ACCEL_CONFIG_FS_SEL_MASK;
+	c |= ACCEL_CONFIG_FS_SEL(uint8_t(setting.accel_fs_sel));
+	config[3] = c;
+
+	// Set accelerometer sample rate configuration
+	c = read_byte(mpu_i2c_addr, ACCEL_CONFIG2);
+	c &= ~(ACCEL_CONFIG2_fchoice_b | ACCEL_CONFIG2_DLPFCFG_MASK);
+	if(setting.accel_fchoice)
+		c |= ACCEL_CONFIG2_fchoice_b;
+	c |= ACCEL_CONFIG2_DLPFCFG(uint8_t(setting.accel_dlpf_cfg));
+	config[4] = c;
+	write_bytes(mpu_i2c_addr, SMPLRT_DIV, 5, config);
+
+	// The accelerometer, gyro, and thermometer are set to 1 kHz sample rates,
+	// but all these rates are further reduced by a factor of 5 to 200 Hz because of the SMPLRT_DIV setting
+
+	// Configure Interrupts and Bypass Enable
+	// Set interrupt pin active high, push-pull, hold interrupt pin level HIGH until interrupt cleared,
+	// clear on read of INT_STATUS, and enable I2C_BYPASS_EN so additional chips
+	// can join the I2C bus and all can be controlled by the Arduino as master
+	// When the magnetometer is read by the I2C master, bypass stays disabled
+	// and the AK8963 is only reachable through the MPU
+	// With an interrupt driven driver INT_STATUS is never read, so let the
+	// data read itself clear the latched pin
+	c = INT_PIN_CFG_LATCH_INT_EN;
+	if (driver->has_interrupt())
+		c |= INT_PIN_CFG_ANYRD_2CLEAR;
+	if (!setting.mag_via_i2c_master)
+		c |= INT_PIN_CFG_BYPASS_EN;
+	const uint8_t int_cfg[2] = {c, INT_ENABLE_RAW_RDY};  // INT_PIN_CFG, INT_ENABLE
+	write_bytes(mpu_i2c_addr, INT_PIN_CFG, 2, int_cfg);
+	if (setting.mag_via_i2c_master)
+		init_i2c_master();
+	if (!b_warm_start)
+		driver->delay(100);
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::init_i2c_master() {
+	// 400 kHz auxiliary bus, hold data ready until the external sensor data is loaded
+	write_byte(mpu_i2c_addr, I2C_MST_CTRL, I2C_MST_CTRL_WAIT_FOR_ES | I2C_MST_CTRL_CLK(13));
+	modify_byte(USER_CTRL, 0x00, USER_CTRL_I2C_MST_EN);
+	set_mag_polling(true);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::set_mag_polling(bool b) {
+	// SLV0 reads ST1, the measurement data and ST2 into EXT_SENS_DATA_00..07
+	// every sample, right behind GYRO_ZOUT_L
+	if (b) {
+		const uint8_t slv0[3] = {I2C_SLV_ADDR_RW | AK8963_ADDRESS, AK8963_ST1, I2C_SLV_CTRL_EN | I2C_SLV_CTRL_LENG(8)};
+		write_bytes(mpu_i2c_addr, I2C_SLV0_ADDR, 3, slv0);
+	} else {
+		write_byte(mpu_i2c_addr, I2C_SLV0_CTRL, 0x00);
+	}
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::initAK8963() {
+	if (setting.mag_via_i2c_master)
+		set_mag_polling(false);                     // keep SLV0 off the AK8963 while reconfiguring
+	mag_write_byte(AK8963_CNTL, 0x00);              // Power down magnetometer
+	driver->delay(b_warm_start ? 1 : 10);           // mode changes need 100 us in power down
+
+	// First extract the factory calibration for each magnetometer axis
+	// (a warm start already has it)
+	if (!b_warm_start) {
+		uint8_t raw_data[3];                        // x/y/z gyro calibration data stored here
+		mag_write_byte(AK8963_CNTL, 0x0F);          // Enter Fuse ROM access mode
+		driver->delay(10);
+		mag_read_bytes(AK8963_ASAX, 3, &raw_data[0]);
+		// store sensitivity adjustment values
+		mag_bias_factory[0] = (float)(raw_data[0] - 128) / 256. + 1.;
+		mag_bias_factory[1] = (float)(raw_data[1] - 128) / 256. + 1.;
+		mag_bias_factory[2] = (float)(raw_data[2] - 128) / 256. + 1.;
+		mag_write_byte(AK8963_CNTL, 0x00);          // Power down magnetometer
+		driver->delay(10);
+	}
+	// Configure the magnetometer for continuous read and highest resolution
+	// set Mscale bit 4 to 1 (0) to enable 16 (14) bit resolution in CNTL register,
+	// and enable continuous mode data acquisition MAG_MODE (bits [3:0]), 0010 for 8 Hz and 0110 for 100 Hz sample rates
+	mag_write_byte(AK8963_CNTL, (uint8_t)setting.mag_output_bits << 4 | MAG_MODE);  // Set magnetometer data resolution and sample ODR
+	bool ready = true;
+	if (b_warm_start)
+		ready = wait_mag_ready();
+	else
+		driver->delay(10);
+	if (setting.mag_via_i2c_master)
+		set_mag_polling(true);
+	return ready;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::wait_reset_done() {
+	// H_RESET clears itself when the reset is complete. Read past the
+	// shadow, which already assumes the reset values.
+	for (uint8_t i = 0; i < 100; ++i) {
+		uint8_t c = PWR_MGMT_1_H_RESET;
+		read_bytes(mpu_i2c_addr, PWR_MGMT_1, 1, &c);
+		if (!(c & PWR_MGMT_1_H_RESET))
+			return true;
+		driver->delay(1);
+	}
+	return false;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::wait_mag_ready() {
+	// first measurement of the continuous mode (10 ms at 100 Hz, 125 ms at 8 Hz)
+	for (uint8_t i = 0; i < 150; ++i) {
+		if (mag_read_byte(AK8963_ST1) & AK8963_ST1_DRDY)
+			return true;
+		driver->delay(1);
+	}
+	return false;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::wait_first_sample() {
+	// gyro start-up is 35 ms typical, data ready marks the first sample
+	for (uint8_t i = 0; i < 100; ++i) {
+		if (read_byte(mpu_i2c_addr, INT_STATUS) & INT_STATUS_RAW_RDY)
+			return true;
+		driver->delay(1);
+	}
+	return false;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::sleep(bool b) {
+	// change the sleep bit to match b, the other bits come from the shadow
+	modify_byte(PWR_MGMT_1, PWR_MGMT_1_SLEEP, b ? PWR_MGMT_1_SLEEP : 0x00);
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::update() {
+	if (!available())
+		return false;
+	return update_sample();
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::update(uint32_t timeout_ms) {
+	if (!wait_available(timeout_ms))
+		return false;
+	return update_sample();
+}
+
+template <typename FilterT, typename DriverT>
+template <typename D>
+bool BasicMPU<FilterT, DriverT>::updateAsync() {
+	if (b_fifo)
+		return update();
+
+	D* async_driver = static_cast<D*>(driver);
+	int16_t raw_acc_gyro_data[FIFO_FRAME_WORDS];
+	bool has_sample = false;
+	bool new_mag = false;
+
+	if (async_busy) {
+		if (!async_driver->transfer_done())
+			return false;
+		async_busy = false;
+		decode_accel_gyro(async_buf, raw_acc_gyro_data);
+		if (setting.mag_via_i2c_master)
+			new_mag = decode_mag(&async_buf[FIFO_FRAME_SIZE], mag_count);
+		else
+			new_mag = read_mag(mag_count);  // while the bus is still free
+		has_sample = true;
+	}
+
+	// start the next transfer before working on this sample
+	if (available()) {
+		const uint8_t length = setting.mag_via_i2c_master ? FIFO_MAG_FRAME_SIZE : FIFO_FRAME_SIZE;
+		async_busy = async_driver->submit_read(mpu_i2c_addr, ACCEL_XOUT_H, async_buf, length);
+	}
+
+	if (!has_sample)
+		return false;
+	if (new_mag)
+		apply_mag(mag_count);
+	apply_accel_gyro(raw_acc_gyro_data);
+	if (queue)
+		enqueue(raw_acc_gyro_data, new_mag ? Sample::MAG_VALID : 0);
+	update_filter();
+	// not update_output(): the temperature came with the frame and the bus is busy
+	if (b_ahrs)
+		update_rpy(q[0], q[1], q[2], q[3]);
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::wait_available(uint32_t timeout_ms) {
+	if (!has_connected)
+		return false;
+	if (driver->has_interrupt())
+		return driver->wait_interrupt(timeout_ms);
+	// the FIFO is checked through its count when draining
+	if (b_fifo)
+		return true;
+	for (;;) {
+		if (read_byte(mpu_i2c_addr, INT_STATUS) & INT_STATUS_RAW_RDY)
+			return true;
+		if (timeout_ms-- == 0)
+			return false;
+		driver->delay(1);
+	}
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::update_sample() {
+	if (b_fifo)
+		return update_fifo();
+
+	int16_t raw_acc_gyro_data[FIFO_FRAME_WORDS];
+	bool new_mag = read_frame(raw_acc_gyro_data);
+	if (new_mag)
+		apply_mag(mag_count);
+	apply_accel_gyro(raw_acc_gyro_data);
+	if (queue)
+		enqueue(raw_acc_gyro_data, new_mag ? Sample::MAG_VALID : 0);
+	update_filter();
+	update_output();
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::update_fifo() {
+	// one FIFO_COUNT read and one burst of everything it counts, frames that
+	// arrive meanwhile are left for the next call
+	int16_t frames[FIFO_BUFFER_WORDS];
+	const uint8_t n_words = fifoFrameWords();
+	const size_t n = readFifo(frames, FIFO_BUFFER_WORDS / n_words);
+	if (n == 0)
+		return false;
+
+	// in bypass mode the magnetometer is not part of the FIFO, sample it
+	// once per drain, with the first frame
+	uint8_t mag_flags = 0;
+	if (!setting.mag_via_i2c_master && read_mag(mag_count)) {
+		apply_mag(mag_count);
+		mag_flags = Sample::MAG_VALID;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		const int16_t* frame = &frames[i * n_words];
+		apply_accel_gyro(frame);
+		if (n_words == FIFO_MAG_FRAME_WORDS) {
+			mag_flags = frame[10];
+			if (mag_flags == Sample::MAG_VALID) {
+				mag_count[0] = frame[7];
+				mag_count[1] = frame[8];
+				mag_count[2] = frame[9];
+				apply_mag(mag_count);
+			}
+		}
+		if (queue)
+			enqueue(frame, mag_flags);
+		mag_flags = 0;
+		update_filter();
+	}
+
+	update_output();
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_filter() {
+	// Madgwick function needs to be fed North, East, and Down direction like
+	// (AN, AE, AD, GN, GE, GD, MN, ME, MD)
+	// Accel and Gyro direction is Right-Hand, X-Forward, Z-Up
+	// Magneto direction is Right-Hand, Y-Forward, Z-Down
+	// So to adopt to the general Aircraft coordinate system (Right-Hand, X-Forward, Z-Down),
+	// we need to feed (ax, -ay, -az, gx, -gy, -gz, my, -mx, mz)
+	// but we pass (-ax, ay, az, gx, -gy, -gz, my, -mx, mz)
+	// because gravity is by convention positive down, we need to ivnert the accel data
+
+	// get quaternion based on aircraft coordinate (Right-Hand, X-Forward, Z-Down)
+	// acc[mg], gyro[deg/s], mag [mG]
+	// gyro will be convert from [deg/s] to [rad/s] inside of this function
+	// quat_filter.update(-a[0], a[1], a[2], g[0] * DEG_TO_RAD, -g[1] * DEG_TO_RAD, -g[2] * DEG_TO_RAD, m[1], -m[0], m[2], q);
+
+	// dt comes from the sample timestamps, so it is sensor (or driver clock)
+	// time, and is split evenly over the iterations
+	uint32_t dt_us = has_filter_time ? sample_time_us - filter_time_us : sample_period_us;
+	filter_time_us = sample_time_us;
+	has_filter_time = true;
+
+	// the overload taking FixedFilter* is chosen for fixed point filter types
+	run_filter(filter, filter, dt_us);
+}
+
+template <typename FilterT, typename DriverT>
+template <typename F>
+void BasicMPU<FilterT, DriverT>::run_filter(F* f, const Filter*, uint32_t dt_us) {
+	float an = -a[0];
+	float ae = +a[1];
+	float ad = +a[2];
+	float gn = +deg_to_rad(g[0]);
+	float ge = -deg_to_rad(g[1]);
+	float gd = -deg_to_rad(g[2]);
+	float mn = +m[1];
+	float me = -m[0];
+	float md = +m[2];
+	const double dt = dt_us * 1e-6 / n_filter_iter;
+
+	// call update_impl through FilterT so that a final filter class is
+	// dispatched (and can be inlined) statically
+	for (size_t i = 0; i < n_filter_iter; ++i) {
+		f->update_impl(an, ae, ad, gn, ge, gd, mn, me, md, dt, q);
+	}
+}
+
+template <typename FilterT, typename DriverT>
+template <typename F>
+void BasicMPU<FilterT, DriverT>::run_filter(F* f, const FixedFilter*, uint32_t dt_us) {
+	// the same axes as the float path, straight from the raw counts; only
+	// the directions of acc and mag are used, so their scales do not matter
+	q24_t acc[3] {-(q24_t)acc_gyro_count[0], +acc_gyro_count[1], +acc_gyro_count[2]};
+	q24_normalize(acc, 3);
+	q24_t gyro[3];
+	if (gyro_estimator) {
+		// the estimated bias is only known in float
+		gyro[0] = to_q24(+deg_to_rad(g[0]));
+		gyro[1] = to_q24(-deg_to_rad(g[1]));
+		gyro[2] = to_q24(-deg_to_rad(g[2]));
+	} else {
+		gyro[0] = +acc_gyro_count[4] * gyro_res_q24;
+		gyro[1] = -acc_gyro_count[5] * gyro_res_q24;
+		gyro[2] = -acc_gyro_count[6] * gyro_res_q24;
+	}
+	int32_t mc[3];
+	for (uint8_t i = 0; i < 3; ++i)
+		mc[i] = mag_count[i] * mag_gain_q14[i] - mag_offset_q14[i];
+	q24_t mag[3] {+mc[1], -mc[0], +mc[2]};
+	q24_normalize(mag, 3);
+	// dt_us * 2^24 / 10^6
+	const q24_t dt = (q24_t)(((uint64_t)dt_us * 1099512u) >> 16) / (q24_t)n_filter_iter;
+
+	f->sync_quaternion(q);
+	for (size_t i = 0; i < n_filter_iter; ++i)
+		f->update_fixed(acc, gyro, mag, dt);
+	f->write_quaternion(q);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_fixed_scaling() {
+	gyro_res_q24 = to_q24(deg_to_rad(gyro_resolution));
+	// mag in counts of the current resolution, as in scale_mag():
+	// (count * asa - mag_bias / res16) * scale, Q14 keeps it within 32 bits
+	const float res16 = get_mag_resolution(MAG_OUTPUT_BITS::M16BITS);
+	for (uint8_t i = 0; i < 3; ++i) {
+		mag_gain_q14[i] = (int32_t)(mag_bias_factory[i] * mag_scale[i] * 16384.f + 0.5f);
+		mag_offset_q14[i] = (int32_t)(mag_bias[i] / res16 * mag_scale[i] * 16384.f);
+	}
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_output() {
+	if (!b_ahrs) {
+		temperature_count = read_temperature_data();               // Read the adc values
+		temperature = ((float)temperature_count) / 333.87 + 21.0;  // Temperature in degrees Centigrade
+	} else {
+		update_rpy(q[0], q[1], q[2], q[3]);
+	}
+}
+
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_rpy(float qw, float qx, float qy, float qz) {
+	// Define output variables from updated quaternion---these are Tait-Bryan angles, commonly used in aircraft orientation.
+	// In this coordinate system, the positive z-axis is down toward Earth.
+	// Yaw is the angle between Sensor x-axis and Earth magnetic North (or true North if corrected for local declination, looking down on the sensor positive yaw is counterclockwise.
+	// Pitch is angle between sensor x-axis and Earth ground plane, toward the Earth is positive, up toward the sky is negative.
+	// Roll is angle between sensor y-axis and Earth ground plane, y-axis up is positive roll.
+	// These arise from the definition of the homogeneous rotation matrix constructed from quaternions.
+	// Tait-Bryan angles as well as Euler angles are non-commutative; that is, the get the correct orientation the rotations must be
+	// applied in the correct order which for this configuration is yaw, pitch, and then roll.
+	// For more see http://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles which has additional links.
+	float a12, a22, a31, a32, a33;  // rotation matrix coefficients for Euler angles and gravity components
+	a12 = 2.0f * (qx * qy + qw * qz);
+	a22 = qw * qw + qx * qx - qy * qy - qz * qz;
+	a31 = 2.0f * (qw * qx + qy * qz);
+	a32 = 2.0f * (qx * qz - qw * qy);
+	a33 = qw * qw - qx * qx - qy * qy + qz * qz;
+	rpy[0] = fast_atan2(a31, a33);
+	rpy[1] = -fast_asin(a32);
+	rpy[2] = fast_atan2(a12, a22);
+	rpy[0] *= 180.0f / pi;
+	rpy[1] *= 180.0f / pi;
+	rpy[2] *= 180.0f / pi;
+	rpy[2] += magnetic_declination;
+	if (rpy[2] >= +180.f)
+		rpy[2] -= 360.f;
+	else if (rpy[2] < -180.f)
+		rpy[2] += 360.f;
+
+	lin_acc[0] = a[0] + a31;
+	lin_acc[1] = a[1] + a32;
+	lin_acc[2] = a[2] - a33;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_accel_gyro() {
+	int16_t raw_acc_gyro_data[7];        // used to read all 14 bytes at once from the MPU9250 accel/gyro
+	read_accel_gyro(raw_acc_gyro_data);  // INT cleared on any read
+	apply_accel_gyro(raw_acc_gyro_data);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::apply_accel_gyro(const int16_t* raw_acc_gyro_data) {
+	stamp_sample();
+	for (uint8_t i = 0; i < 7; ++i)
+		acc_gyro_count[i] = raw_acc_gyro_data[i];
+	temperature_count = raw_acc_gyro_data[3];  // Read the adc values
+	scale_accel_gyro(raw_acc_gyro_data, a, g, &temperature);
+	if (gyro_estimator)
+		correct_gyro_bias();
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::correct_gyro_bias() {
+	const bool refined = gyro_estimator->update(a, g);
+	const float* bias = gyro_estimator->getBias();
+	for (uint8_t i = 0; i < 3; ++i)
+		g[i] -= bias[i];
+	if (!refined || !b_push_gyro_bias)
+		return;
+
+	// offset registers count 4 LSB of the 250dps scale, and write_gyro_offset()
+	// truncates, so compare the register values to know what really moved
+	float moved[3];
+	bool changed = false;
+	for (uint8_t i = 0; i < 3; ++i) {
+		int16_t before = -(int16_t)gyro_bias[i] / 4;
+		float bias_counts = gyro_bias[i] + bias[i] * CALIB_GYRO_SENSITIVITY;
+		int16_t after = -(int16_t)bias_counts / 4;
+		moved[i] = -(float)(after - before) * 4.f / CALIB_GYRO_SENSITIVITY;
+		if (after != before) {
+			gyro_bias[i] = -4.f * after;  // what the register holds, the rest stays in the estimate
+			changed = true;
+		}
+	}
+	if (changed) {
+		write_gyro_offset();
+		gyro_estimator->shift(moved);
+	}
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::scale_accel_gyro(const int16_t* raw_acc_gyro_data, float* acc, float* gyro, float* temp) const {
+	// Now we'll calculate the accleration value into actual g's
+	acc[0] = (float)raw_acc_gyro_data[0] * acc_resolution;  // get actual g value, this depends on scale being set
+	acc[1] = (float)raw_acc_gyro_data[1] * acc_resolution;
+	acc[2] = (float)raw_acc_gyro_data[2] * acc_resolution;
+
+	*temp = ((float)raw_acc_gyro_data[3]) / 333.87 + 21.0;  // Temperature in degrees Centigrade
+
+	// Calculate the gyro value into actual degrees per second
+	gyro[0] = (float)raw_acc_gyro_data[4] * gyro_resolution;  // get actual gyro value, this depends on scale being set
+	gyro[1] = (float)raw_acc_gyro_data[5] * gyro_resolution;
+	gyro[2] = (float)raw_acc_gyro_data[6] * gyro_resolution;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::read_accel_gyro(int16_t* destination) {
+	uint8_t raw_data[14];                                                 // x/y/z accel register data stored here
+	read_bytes(mpu_i2c_addr, ACCEL_XOUT_H, 14, &raw_data[0]);             // Read the 14 raw data registers into data array
+	decode_accel_gyro(raw_data, destination);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::decode_accel_gyro(const uint8_t* raw_data, int16_t* destination) const {
+	decode_be16(raw_data, 7, destination);  // Turn the MSB and LSB into signed 16-bit values
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::read_frame(int16_t* raw_acc_gyro_data) {
+	if (!setting.mag_via_i2c_master) {
+		read_accel_gyro(raw_acc_gyro_data);
+		return read_mag(mag_count);
+	}
+	// accel, temperature, gyro and EXT_SENS_DATA_00..07 (AK8963 ST1..ST2) in one burst
+	uint8_t raw_data[22];
+	read_bytes(mpu_i2c_addr, ACCEL_XOUT_H, 22, &raw_data[0]);
+	decode_accel_gyro(raw_data, raw_acc_gyro_data);
+	return decode_mag(&raw_data[14], mag_count);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::update_mag() {
+	// Read the x/y/z adc values
+	if (read_mag(mag_count))
+		apply_mag(mag_count);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::apply_mag(const int16_t* mag_count) {
+	if (mag_calibrator) {
+		float raw[3];
+		for (uint8_t i = 0; i < 3; ++i)
+			raw[i] = mag_count[i] * mag_resolution * mag_bias_factory[i];
+		if (mag_calibrator->update(raw[0], raw[1], raw[2])) {
+			// mag_bias is kept in 16BITS terms, see scale_mag()
+			float bias_to_current_bits = mag_resolution / get_mag_resolution(MAG_OUTPUT_BITS::M16BITS);
+			const float* bias = mag_calibrator->getBias();
+			const float* scale = mag_calibrator->getScale();
+			for (uint8_t i = 0; i < 3; ++i) {
+				mag_bias[i] = bias[i] / bias_to_current_bits;
+				mag_scale[i] = scale[i];
+			}
+			update_fixed_scaling();
+		}
+	}
+	scale_mag(mag_count, m);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::scale_mag(const int16_t* mag_count, float* mag) const {
+	// Calculate the magnetometer values in milliGauss
+	// Include factory calibration per data sheet and user environmental corrections
+	// mag_bias is calcurated in 16BITS
+	float bias_to_current_bits = mag_resolution / get_mag_resolution(MAG_OUTPUT_BITS::M16BITS);
+	mag[0] = (float)(mag_count[0] * mag_resolution * mag_bias_factory[0] - mag_bias[0] * bias_to_current_bits) * mag_scale[0];  // get actual magnetometer value, this depends on scale being set
+	mag[1] = (float)(mag_count[1] * mag_resolution * mag_bias_factory[1] - mag_bias[1] * bias_to_current_bits) * mag_scale[1];
+	mag[2] = (float)(mag_count[2] * mag_resolution * mag_bias_factory[2] - mag_bias[2] * bias_to_current_bits) * mag_scale[2];
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::read_mag(int16_t* destination) {
+	uint8_t raw_data[8];                                                 // ST1, x/y/z mag register data, ST2 register stored here, must read ST2 at end of data acquisition
+	if (setting.mag_via_i2c_master) {
+		read_bytes(mpu_i2c_addr, EXT_SENS_DATA_00, 8, &raw_data[0]);     // latest ST1..ST2 fetched by I2C_SLV0
+	} else {
+		raw_data[0] = read_byte(AK8963_ADDRESS, AK8963_ST1);
+		if (!(raw_data[0] & AK8963_ST1_DRDY))                            // wait for magnetometer data ready bit to be set
+			return false;
+		read_bytes(AK8963_ADDRESS, AK8963_XOUT_L, 7, &raw_data[1]);      // Read the six raw data and ST2 registers sequentially into data array
+	}
+	return decode_mag(raw_data, destination);
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::decode_mag(const uint8_t* raw_data, int16_t* destination) const {
+	const uint8_t st1 = raw_data[0];
+	if (st1 & AK8963_ST1_DRDY) {                                         // wait for magnetometer data ready bit to be set
+		if (MAG_MODE == 0x02 || MAG_MODE == 0x04 || MAG_MODE == 0x06) {  // continuous or external trigger read mode
+			if ((st1 & 0x02) != 0)                                       // check if data is not skipped
+				return false;                                            // this should be after data reading to clear DRDY register
+		}
+
+		uint8_t c = raw_data[7];                                         // End data read by reading ST2 register
+		if (!(c & 0x08)) {                                               // Check if magnetic sensor overflow set, if not then report data
+			destination[0] = ((int16_t)raw_data[2] << 8) | raw_data[1];  // Turn the MSB and LSB into a signed 16-bit value
+			destination[1] = ((int16_t)raw_data[4] << 8) | raw_data[3];  // Data stored as little Endian
+			destination[2] = ((int16_t)raw_data[6] << 8) | raw_data[5];
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename FilterT, typename DriverT>
+int16_t BasicMPU<FilterT, DriverT>::read_temperature_data() {
+	uint8_t raw_data[2];                                    // x/y/z gyro register data stored here
+	read_bytes(mpu_i2c_addr, TEMP_OUT_H, 2, &raw_data[0]);  // Read the two raw data registers sequentially into data array
+	return ((int16_t)raw_data[0] << 8) | raw_data[1];       // Turn the MSB and LSB into a 16-bit value
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::enableFifo() {
+	// stream accel, temperature and gyro into the FIFO at the configured ODR
+	write_byte(mpu_i2c_addr, FIFO_EN, 0x00);
+	reset_fifo();
+	uint8_t fifo_en = FIFO_EN_TEMP | FIFO_EN_GYROX | FIFO_EN_GYROY | FIFO_EN_GYROZ | FIFO_EN_ACCEL;
+	if (setting.mag_via_i2c_master)
+		fifo_en |= FIFO_EN_SLV_0;  // append the SLV0 bytes (AK8963 ST1..ST2) to every frame
+	write_byte(mpu_i2c_addr, FIFO_EN, fifo_en);
+	b_fifo = true;
+	has_filter_time = false;  // switching time base
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::disableFifo() {
+	write_byte(mpu_i2c_addr, FIFO_EN, 0x00);
+	modify_byte(USER_CTRL, USER_CTRL_FIFO_EN, 0x00);
+	b_fifo = false;
+	has_filter_time = false;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::reset_fifo() {
+	uint8_t c = read_byte(mpu_i2c_addr, USER_CTRL);
+	write_byte(mpu_i2c_addr, USER_CTRL, (c & ~USER_CTRL_FIFO_EN) | USER_CTRL_FIFO_RST);
+	write_byte(mpu_i2c_addr, USER_CTRL, c | USER_CTRL_FIFO_EN);
+}
+
+template <typename FilterT, typename DriverT>
+uint16_t BasicMPU<FilterT, DriverT>::fifoCount() {
+	uint8_t data[2];
+	read_bytes(mpu_i2c_addr, FIFO_COUNTH, 2, &data[0]);
+	return ((uint16_t)(data[0] & FIFO_COUNTH_MASK) << 8) | data[1];
+}
+
+template <typename FilterT, typename DriverT>
+size_t BasicMPU<FilterT, DriverT>::readFifo(int16_t* dest, size_t max_frames) {
+	uint16_t fifo_count = fifoCount();
+	if (fifo_count >= FIFO_SIZE) {
+		// oldest bytes have been overwritten, frames are no longer aligned
+		reset_fifo();
+		return 0;
+	}
+
+	const bool with_mag = setting.mag_via_i2c_master;
+	const uint8_t frame_size = with_mag ? FIFO_MAG_FRAME_SIZE : FIFO_FRAME_SIZE;
+	const uint8_t frame_words = with_mag ? FIFO_MAG_FRAME_WORDS : FIFO_FRAME_WORDS;
+	size_t n_frames = fifo_count / frame_size;
+	if (n_frames > max_frames)
+		n_frames = max_frames;
+	if (n_frames == 0)
+		return 0;
+
+	// a decoded frame has the same size as a raw one, so read straight into
+	// the destination and decode in place
+	uint8_t* raw_data = reinterpret_cast<uint8_t*>(dest);
+	read_bytes(mpu_i2c_addr, FIFO_R_W, n_frames * frame_size, raw_data);
+	if (!with_mag) {
+		decode_be16(raw_data, n_frames * FIFO_FRAME_WORDS, dest);
+		return n_frames;
+	}
+	for (size_t i = 0; i < n_frames; ++i) {
+		uint8_t* raw_frame = &raw_data[i * frame_size];
+		int16_t* frame = &dest[i * frame_words];
+		uint8_t raw_mag[8];
+		for (uint8_t j = 0; j < 8; ++j)
+			raw_mag[j] = raw_frame[FIFO_FRAME_SIZE + j];
+		decode_be16(raw_frame, FIFO_FRAME_WORDS, frame);
+		bool valid = decode_mag(raw_mag, &frame[7]);
+		if (!valid)
+			frame[7] = frame[8] = frame[9] = 0;
+		frame[10] = valid ? Sample::MAG_VALID : 0;
+	}
+	return n_frames;
+}
+
+template <typename FilterT, typename DriverT>
+size_t BasicMPU<FilterT, DriverT>::readFifoScaled(float* dest, size_t max_frames) {
+	uint16_t fifo_count = fifoCount();
+	if (fifo_count >= FIFO_SIZE) {
+		reset_fifo();
+		return 0;
+	}
+
+	const uint8_t frame_size = setting.mag_via_i2c_master ? FIFO_MAG_FRAME_SIZE : FIFO_FRAME_SIZE;
+	size_t n_frames = fifo_count / frame_size;
+	if (n_frames > max_frames)
+		n_frames = max_frames;
+	if (n_frames == 0)
+		return 0;
+
+	// A decoded frame takes 28 bytes, so the burst is read into the end of
+	// dest. Frames with magnetometer data are packed to 14 bytes towards
+	// the end first (last one first, each moves up), then dest holds the
+	// raw frames in its upper half, which decode_frames() can work on.
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(dest);
+	const size_t n_bytes = n_frames * DECODE_FRAME_WORDS * sizeof(float);
+	uint8_t* raw_data = &bytes[n_bytes - n_frames * frame_size];
+	read_bytes(mpu_i2c_addr, FIFO_R_W, n_frames * frame_size, raw_data);
+	uint8_t* packed = &bytes[n_bytes / 2];
+	if (frame_size != FIFO_FRAME_SIZE) {
+		for (size_t i = n_frames; i-- > 0;)
+			memmove(&packed[i * FIFO_FRAME_SIZE], &raw_data[i * frame_size], FIFO_FRAME_SIZE);
+	}
+
+	const float scale[DECODE_FRAME_WORDS] {
+		acc_resolution, acc_resolution, acc_resolution, 1.f / 333.87f,
+		gyro_resolution, gyro_resolution, gyro_resolution
+	};
+	const float offset[DECODE_FRAME_WORDS] {0.f, 0.f, 0.f, 21.f, 0.f, 0.f, 0.f};
+	decode_frames(packed, n_frames, scale, offset, dest);
+	return n_frames;
+}
+
+template <typename FilterT, typename DriverT>
+size_t BasicMPU<FilterT, DriverT>::readBatch(Sample* out, size_t max) {
+	if (max == 0 || !available())
+		return 0;
+
+	if (!b_fifo) {
+		int16_t raw_acc_gyro_data[FIFO_FRAME_WORDS];
+		bool new_mag = read_frame(raw_acc_gyro_data);
+		to_sample(raw_acc_gyro_data, out[0]);
+		out[0].flags = new_mag ? Sample::MAG_VALID : 0;
+		return 1;
+	}
+
+	// one FIFO_COUNT read and one burst, as in update()
+	int16_t frames[FIFO_BUFFER_WORDS];
+	const bool with_mag = setting.mag_via_i2c_master;
+	const uint8_t n_words = fifoFrameWords();
+	const size_t n_max = FIFO_BUFFER_WORDS / n_words;
+	const size_t n = readFifo(frames, max < n_max ? max : n_max);
+	for (size_t i = 0; i < n; ++i) {
+		const int16_t* frame = &frames[i * n_words];
+		Sample& sample = out[i];
+		if (with_mag && frame[10] == Sample::MAG_VALID) {
+			mag_count[0] = frame[7];
+			mag_count[1] = frame[8];
+			mag_count[2] = frame[9];
+		}
+		to_sample(frame, sample);
+		if (with_mag)
+			sample.flags = frame[10];
+	}
+
+	// in bypass mode the magnetometer is not part of the FIFO, sample it
+	// once per drain, with the first frame, and only if there is one
+	if (!with_mag && n > 0 && read_mag(mag_count)) {
+		for (size_t i = 0; i < n; ++i)
+			for (uint8_t j = 0; j < 3; ++j)
+				out[i].mag[j] = mag_count[j];
+		out[0].flags = Sample::MAG_VALID;
+	}
+	return n;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::stamp_sample() {
+	// FIFO frames are exactly one ODR period apart, polled samples may not be
+	if (!b_fifo && driver->has_clock())
+		sample_time_us = driver->micros();
+	else
+		sample_time_us += sample_period_us;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::to_sample(const int16_t* raw_acc_gyro_data, Sample& sample) {
+	stamp_sample();
+	fill_sample(raw_acc_gyro_data, sample);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::fill_sample(const int16_t* raw_acc_gyro_data, Sample& sample) const {
+	sample.timestamp = sample_time_us;
+	sample.acc[0] = raw_acc_gyro_data[0];
+	sample.acc[1] = raw_acc_gyro_data[1];
+	sample.acc[2] = raw_acc_gyro_data[2];
+	sample.temperature = raw_acc_gyro_data[3];
+	sample.gyro[0] = raw_acc_gyro_data[4];
+	sample.gyro[1] = raw_acc_gyro_data[5];
+	sample.gyro[2] = raw_acc_gyro_data[6];
+	sample.mag[0] = mag_count[0];
+	sample.mag[1] = mag_count[1];
+	sample.mag[2] = mag_count[2];
+	sample.flags = 0;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::enqueue(const int16_t* raw_acc_gyro_data, uint8_t flags) {
+	// after apply_accel_gyro(), which stamped the sample
+	Sample sample;
+	fill_sample(raw_acc_gyro_data, sample);
+	sample.flags = flags;
+	queue->push(sample);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::scaleBatch(const Sample* in, ScaledSample* out, size_t n) const {
+	for (size_t i = 0; i < n; ++i) {
+		const int16_t raw_acc_gyro_data[FIFO_FRAME_WORDS] {
+			in[i].acc[0], in[i].acc[1], in[i].acc[2], in[i].temperature,
+			in[i].gyro[0], in[i].gyro[1], in[i].gyro[2]
+		};
+		out[i].timestamp = in[i].timestamp;
+		scale_accel_gyro(raw_acc_gyro_data, out[i].acc, out[i].gyro, &out[i].temperature);
+		scale_mag(in[i].mag, out[i].mag);
+	}
+}
+
+// Function which accumulates gyro and accelerometer data after device initialization. It calculates the average
+// of the at-rest readings and then loads the resulting offsets into accelerometer and gyro bias registers.
+// ACCEL_FS_SEL: 2g (maximum sensitivity)
+// GYRO_FS_SEL: 250dps (maximum sensitivity)
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::calibrate_acc_gyro_impl(uint16_t n_samples) {
+	if (n_samples == 0)
+		return false;
+	float a_bias[3], g_bias[3];
+	const bool ok = set_acc_gyro_to_calibration() && collect_acc_gyro_data_to(a_bias, g_bias, n_samples);
+	if (ok) {
+		for (uint8_t i = 0; i < 3; ++i) {
+			acc_bias[i] = a_bias[i];
+			gyro_bias[i] = g_bias[i];
+		}
+	}
+
+	// the reset in initMPU9250() clears the offset registers, so restore the
+	// configuration first and write the offsets afterwards (the previous ones
+	// if the collection failed). Readiness is polled as in a warm start, the
+	// device was running until now.
+	bool warm = b_warm_start;
+	b_warm_start = true;
+	bool ready = initMPU9250();
+	b_warm_start = warm;
+	write_accel_offset();
+	write_gyro_offset();
+	if (b_fifo)
+		enableFifo();  // device was reset, restart streaming
+	ready = ready && wait_first_sample();
+	return ok && ready;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::set_acc_gyro_to_calibration() {
+	// reset device
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, 0x80);  // Write a one to bit 7 reset bit; toggle reset device
+	if (!wait_reset_done())
+		return false;
+
+	// get stable time source; Auto select clock source to be PLL gyroscope reference if ready
+	// else use the internal oscillator, bits 2:0 = 001
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, 0x01);
+	write_byte(mpu_i2c_addr, PWR_MGMT_2, 0x00);
+	driver->delay(200);
+
+	// Configure device for bias calculation
+	write_byte(mpu_i2c_addr, INT_ENABLE, 0x00);    // Disable all interrupts
+	write_byte(mpu_i2c_addr, FIFO_EN, 0x00);       // Disable FIFO
+	write_byte(mpu_i2c_addr, PWR_MGMT_1, 0x00);    // Turn on internal clock source
+	write_byte(mpu_i2c_addr, I2C_MST_CTRL, 0x00);  // Disable I2C master
+	write_byte(mpu_i2c_addr, USER_CTRL, 0x00);     // Disable FIFO and I2C master modes
+	write_byte(mpu_i2c_addr, USER_CTRL, 0x0C);     // Reset FIFO and DMP
+	driver->delay(15);
+
+	// Configure MPU6050 gyro and accelerometer for bias calculation
+	const uint8_t config[4] = {
+		0x00,  // SMPLRT_DIV: Set sample rate to 1 kHz
+		0x01,  // CONFIG: Set low-pass filter to 188 Hz
+		0x00,  // GYRO_CONFIG: Set gyro full-scale to 250 degrees per second, maximum sensitivity
+		0x00,  // ACCEL_CONFIG: Set accelerometer full-scale to 2 g, maximum sensitivity
+	};
+	write_bytes(mpu_i2c_addr, SMPLRT_DIV, 4, config);
+
+	// Configure FIFO to capture accelerometer and gyro data for bias calculation
+	write_byte(mpu_i2c_addr, USER_CTRL, 0x40);  // Enable FIFO
+	write_byte(mpu_i2c_addr, FIFO_EN, 0x78);    // Enable gyro and accelerometer sensors for FIFO  (max size 512 bytes in MPU-9150)
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::collect_acc_gyro_data_to(float* a_bias, float* g_bias, uint16_t n_samples) {
+	// The FIFO fills with one 12 byte frame (accel xyz, gyro xyz) per ms and
+	// holds 42 of them, so it is drained in bursts of CALIB_BURST_FRAMES for
+	// as long as the window lasts. Sums of n_samples counts fit in int32_t.
+	// A stalled sensor (no frames, or a full count from a dead bus)
+	// only makes it wait, so the waits are limited to 4x the window.
+	const uint32_t budget_ms = 4 * (uint32_t)n_samples + CALIB_TIMEOUT_MARGIN_MS;
+	uint32_t waited_ms = 0;
+	int16_t counts[CALIB_BURST_FRAMES * 6];
+	uint8_t* data = reinterpret_cast<uint8_t*>(counts);  // decoded in place
+	int32_t acc_sum[3] = {0, 0, 0}, gyro_sum[3] = {0, 0, 0};
+	uint16_t n = 0;
+	while (n < n_samples) {
+		const uint16_t fifo_count = fifoCount();
+		if (fifo_count >= FIFO_SIZE) {
+			// overflowed, the oldest bytes are gone and frames are no longer aligned
+			reset_fifo();
+			if (waited_ms >= budget_ms)
+				break;
+			driver->delay(1);
+			++waited_ms;
+			continue;
+		}
+		uint16_t n_frames = fifo_count / 12;
+		uint16_t n_wanted = n_samples - n;
+		if (n_wanted > CALIB_BURST_FRAMES)
+			n_wanted = CALIB_BURST_FRAMES;
+		if (n_frames < n_wanted) {
+			if (waited_ms >= budget_ms)
+				break;
+			driver->delay(n_wanted - n_frames);  // 1 kHz: one frame per ms
+			waited_ms += n_wanted - n_frames;
+			continue;
+		}
+		n_frames = n_wanted;
+
+		read_bytes(mpu_i2c_addr, FIFO_R_W, n_frames * 12, &data[0]);
+		decode_be16(data, n_frames * 6, counts);  // Form signed 16-bit integer for each sample in FIFO
+		for (uint16_t i = 0; i < n_frames; ++i) {
+			const int16_t* frame = &counts[i * 6];
+			for (uint8_t j = 0; j < 3; ++j) {
+				acc_sum[j] += frame[j];
+				gyro_sum[j] += frame[3 + j];
+			}
+		}
+		n += n_frames;
+	}
+	write_byte(mpu_i2c_addr, FIFO_EN, 0x00);  // Disable gyro and accelerometer sensors for FIFO
+	if (n < n_samples)
+		return false;  // timed out, a partial average is no calibration
+
+	for (uint8_t j = 0; j < 3; ++j) {
+		a_bias[j] = (float)acc_sum[j] / (float)n;  // Normalize sums to get average count biases
+		g_bias[j] = (float)gyro_sum[j] / (float)n;
+	}
+
+	if (a_bias[2] > 0L) {
+		a_bias[2] -= (float)CALIB_ACCEL_SENSITIVITY;
+	}  // Remove gravity from the z-axis accelerometer bias calculation
+	else {
+		a_bias[2] += (float)CALIB_ACCEL_SENSITIVITY;
+	}
+	return true;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::write_accel_offset() {
+	// Construct the accelerometer biases for push to the hardware accelerometer bias registers. These registers contain
+	// factory trim values which must be added to the calculated accelerometer biases; on boot up these registers will hold
+	// non-zero values. In addition, bit 0 of the lower byte must be preserved since it is used for temperature
+	// compensation calculations. Accelerometer bias registers expect bias input as 2048 LSB per g, so that
+	// the accelerometer biases calculated above must be divided by 8.
+
+	// XA_OFFSET_H..ZA_OFFSET_L span 8 registers (with one unused register
+	// after each pair), read at once unless they are in the shadow
+	uint8_t read_data[8] = {0};
+	int16_t acc_bias_reg[3] = {0, 0, 0};  // A place to hold the factory accelerometer trim biases
+	bool cached = true;
+	for (uint8_t i = 0; i < 3; ++i) {
+		int8_t h = shadow_index(XA_OFFSET_H + 3 * i);
+		int8_t l = shadow_index(XA_OFFSET_L + 3 * i);
+		cached &= (shadow_valid[h >> 3] & (1 << (h & 7))) && (shadow_valid[l >> 3] & (1 << (l & 7)));
+	}
+	if (cached) {
+		for (uint8_t i = 0; i < 3; ++i) {
+			read_data[3 * i] = shadow[shadow_index(XA_OFFSET_H + 3 * i)];
+			read_data[3 * i + 1] = shadow[shadow_index(XA_OFFSET_L + 3 * i)];
+		}
+	} else {
+		read_bytes(mpu_i2c_addr, XA_OFFSET_H, 8, &read_data[0]);  // Read factory accelerometer trim values
+		for (uint8_t i = 0; i < 8; ++i)
+			shadow_store(XA_OFFSET_H + i, read_data[i]);
+	}
+	for (uint8_t i = 0; i < 3; ++i)
+		acc_bias_reg[i] = ((int16_t)read_data[3 * i] << 8) | read_data[3 * i + 1];
+
+	int16_t mask_bit[3] = {1, 1, 1};  // Define array to hold mask bit for each accelerometer bias axis
+	for (int i = 0; i < 3; i++) {
+		if (acc_bias_reg[i] % 2) {
+			mask_bit[i] = 0;
+		}
+		acc_bias_reg[i] -= (int16_t)acc_bias[i] >> 3;  // Subtract calculated averaged accelerometer bias scaled to 2048 LSB/g
+		if (mask_bit[i]) {
+			acc_bias_reg[i] = acc_bias_reg[i] & ~mask_bit[i];  // Preserve temperature compensation bit
+		} else {
+			acc_bias_reg[i] = acc_bias_reg[i] | 0x0001;  // Preserve temperature compensation bit
+		}
+	}
+
+	uint8_t write_data[6] = {0};
+	write_data[0] = (acc_bias_reg[0] >> 8) & 0xFF;
+	write_data[1] = (acc_bias_reg[0]) & 0xFF;
+	write_data[2] = (acc_bias_reg[1] >> 8) & 0xFF;
+	write_data[3] = (acc_bias_reg[1]) & 0xFF;
+	write_data[4] = (acc_bias_reg[2] >> 8) & 0xFF;
+	write_data[5] = (acc_bias_reg[2]) & 0xFF;
+
+	// Push accelerometer biases to hardware registers, one burst per axis pair
+	write_bytes(mpu_i2c_addr, XA_OFFSET_H, 2, &write_data[0]);
+	write_bytes(mpu_i2c_addr, YA_OFFSET_H, 2, &write_data[2]);
+	write_bytes(mpu_i2c_addr, ZA_OFFSET_H, 2, &write_data[4]);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::write_gyro_offset() {
+	// Construct the gyro biases for push to the hardware gyro bias registers, which are reset to zero upon device startup
+	uint8_t gyro_offset_data[6] {0};
+	gyro_offset_data[0] = (-(int16_t)gyro_bias[0] / 4 >> 8) & 0xFF;  // Divide by 4 to get 32.9 LSB per deg/s to conform to expected bias input format
+	gyro_offset_data[1] = (-(int16_t)gyro_bias[0] / 4) & 0xFF;       // Biases are additive, so change sign on calculated average gyro biases
+	gyro_offset_data[2] = (-(int16_t)gyro_bias[1] / 4 >> 8) & 0xFF;
+	gyro_offset_data[3] = (-(int16_t)gyro_bias[1] / 4) & 0xFF;
+	gyro_offset_data[4] = (-(int16_t)gyro_bias[2] / 4 >> 8) & 0xFF;
+	gyro_offset_data[5] = (-(int16_t)gyro_bias[2] / 4) & 0xFF;
+
+	// Push gyro biases to hardware registers, XG_OFFSET_H..ZG_OFFSET_L in one burst
+	write_bytes(mpu_i2c_addr, XG_OFFSET_H, 6, gyro_offset_data);
+}
+
+// mag calibration is executed in MAG_OUTPUT_BITS: 16BITS
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::calibrate_mag_impl() {
+	// set MAG_OUTPUT_BITS to maximum to calibrate
+	MAG_OUTPUT_BITS mag_output_bits_cache = setting.mag_output_bits;
+	setting.mag_output_bits = MAG_OUTPUT_BITS::M16BITS;
+	initAK8963();
+	collect_mag_data_to(mag_bias, mag_scale);
+	update_fixed_scaling();
+
+	// restore MAG_OUTPUT_BITS
+	setting.mag_output_bits = mag_output_bits_cache;
+	initAK8963();
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::collect_mag_data_to(float* m_bias, float* m_scale) {
+	driver->delay(4000);
+
+	// shoot for ~fifteen seconds of mag data
+	uint16_t sample_count = 0;
+	if (MAG_MODE == 0x02)
+		sample_count = 128;     // at 8 Hz ODR, new mag data is available every 125 ms
+	else if (MAG_MODE == 0x06)  // in this library, fixed to 100Hz
+		sample_count = 1500;    // at 100 Hz ODR, new mag data is available every 10 ms
+
+	int32_t bias[3] = {0, 0, 0}, scale[3] = {0, 0, 0};
+	int16_t mag_max[3] = {-32767, -32767, -32767};
+	int16_t mag_min[3] = {32767, 32767, 32767};
+	int16_t mag_temp[3] = {0, 0, 0};
+	for (uint16_t ii = 0; ii < sample_count; ii++) {
+		read_mag(mag_temp);  // Read the mag data
+		for (int jj = 0; jj < 3; jj++) {
+			if (mag_temp[jj] > mag_max[jj]) mag_max[jj] = mag_temp[jj];
+			if (mag_temp[jj] < mag_min[jj]) mag_min[jj] = mag_temp[jj];
+		}
+		if (MAG_MODE == 0x02)
+			driver->delay(135);  // at 8 Hz ODR, new mag data is available every 125 ms
+		if (MAG_MODE == 0x06)
+			driver->delay(12);   // at 100 Hz ODR, new mag data is available every 10 ms
+	}
+
+	// Get hard iron correction
+	bias[0] = (mag_max[0] + mag_min[0]) / 2;  // get average x mag bias in counts
+	bias[1] = (mag_max[1] + mag_min[1]) / 2;  // get average y mag bias in counts
+	bias[2] = (mag_max[2] + mag_min[2]) / 2;  // get average z mag bias in counts
+
+	float bias_resolution = get_mag_resolution(MAG_OUTPUT_BITS::M16BITS);
+	m_bias[0] = (float)bias[0] * bias_resolution * mag_bias_factory[0];  // save mag biases in G for main program
+	m_bias[1] = (float)bias[1] * bias_resolution * mag_bias_factory[1];
+	m_bias[2] = (float)bias[2] * bias_resolution * mag_bias_factory[2];
+
+	// Get soft iron correction estimate
+	//*** multiplication by mag_bias_factory added in accordance with the following comment
+	//*** https://github.com/kriswiner/MPU9250/issues/456#issue-836657973
+	scale[0] = (float)(mag_max[0] - mag_min[0]) * mag_bias_factory[0] / 2;  // get average x axis max chord length in counts
+	scale[1] = (float)(mag_max[1] - mag_min[1]) * mag_bias_factory[1] / 2;  // get average y axis max chord length in counts
+	scale[2] = (float)(mag_max[2] - mag_min[2]) * mag_bias_factory[2] / 2;  // get average z axis max chord length in counts
+
+	float avg_rad = scale[0] + scale[1] + scale[2];
+	avg_rad /= 3.0;
+
+	m_scale[0] = avg_rad / ((float)scale[0]);
+	m_scale[1] = avg_rad / ((float)scale[1]);
+	m_scale[2] = avg_rad / ((float)scale[2]);
+}
+
+// Accelerometer and gyroscope self test; check calibration wrt factory settings
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::self_test_impl()  // Should return percent deviation from factory trim values, +/- 14 or less deviation is a pass
+{
+	uint8_t raw_data[6] = {0, 0, 0, 0, 0, 0};
+	int32_t gAvg[3] = {0}, aAvg[3] = {0}, aSTAvg[3] = {0}, gSTAvg[3] = {0};
+	float factoryTrim[6];
+	uint8_t FS = 0;
+
+	write_byte(mpu_i2c_addr, SMPLRT_DIV, 0x00);       // Set gyro sample rate to 1 kHz
+	write_byte(mpu_i2c_addr, MPU_CONFIG, 0x02);       // Set gyro sample rate to 1 kHz and DLPF to 92 Hz
+	write_byte(mpu_i2c_addr, GYRO_CONFIG, FS << 3);   // Set full scale range for the gyro to 250 dps
+	write_byte(mpu_i2c_addr, ACCEL_CONFIG2, 0x02);    // Set accelerometer rate to 1 kHz and bandwidth to 92 Hz
+	write_byte(mpu_i2c_addr, ACCEL_CONFIG, FS << 3);  // Set full scale range for the accelerometer to 2 g
+
+	for (int ii = 0; ii < 200; ii++) {  // get average current values of gyro and acclerometer
+
+		read_bytes(mpu_i2c_addr, ACCEL_XOUT_H, 6, &raw_data[0]);          // Read the six raw data registers into data array
+		aAvg[0] += (int16_t)(((int16_t)raw_data[0] << 8) | raw_data[1]);  // Turn the MSB and LSB into a signed 16-bit value
+		aAvg[1] += (int16_t)(((int16_t)raw_data[2] << 8) | raw_data[3]);
+		aAvg[2] += (int16_t)(((int16_t)raw_data[4] << 8) | raw_data[5]);
+
+		read_bytes(mpu_i2c_addr, GYRO_XOUT_H, 6, &raw_data[0]);           // Read the six raw data registers sequentially into data array
+		gAvg[0] += (int16_t)(((int16_t)raw_data[0] << 8) | raw_data[1]);  // Turn the MSB and LSB into a signed 16-bit value
+		gAvg[1] += (int16_t)(((int16_t)raw_data[2] << 8) | raw_data[3]);
+		gAvg[2] += (int16_t)(((int16_t)raw_data[4] << 8) | raw_data[5]);
+	}
+
+	for (int ii = 0; ii < 3; ii++) {  // Get average of 200 values and store as average current readings
+		aAvg[ii] /= 200;
+		gAvg[ii] /= 200;
+	}
+
+	// Configure the accelerometer for self-test
+	write_byte(mpu_i2c_addr, ACCEL_CONFIG, 0xE0);  // Enable self test on all three axes and set accelerometer range to +/- 2 g
+	write_byte(mpu_i2c_addr, GYRO_CONFIG, 0xE0);   // Enable self test on all three axes and set gyro range to +/- 250 degrees/s
+	driver->delay(25);                                     // Delay a while to let the device stabilize
+
+	for (int ii = 0; ii < 200; ii++) {  // get average self-test values of gyro and acclerometer
+
+		read_bytes(mpu_i2c_addr, ACCEL_XOUT_H, 6, &raw_data[0]);            // Read the six raw data registers into data array
+		aSTAvg[0] += (int16_t)(((int16_t)raw_data[0] << 8) | raw_data[1]);  // Turn the MSB and LSB into a signed 16-bit value
+		aSTAvg[1] += (int16_t)(((int16_t)raw_data[2] << 8) | raw_data[3]);
+		aSTAvg[2] += (int16_t)(((int16_t)raw_data[4] << 8) | raw_data[5]);
+
+		read_bytes(mpu_i2c_addr, GYRO_XOUT_H, 6, &raw_data[0]);             // Read the six raw data registers sequentially into data array
+		gSTAvg[0] += (int16_t)(((int16_t)raw_data[0] << 8) | raw_data[1]);  // Turn the MSB and LSB into a signed 16-bit value
+		gSTAvg[1] += (int16_t)(((int16_t)raw_data[2] << 8) | raw_data[3]);
+		gSTAvg[2] += (int16_t)(((int16_t)raw_data[4] << 8) | raw_data[5]);
+	}
+
+	for (int ii = 0; ii < 3; ii++) {  // Get average of 200 values and store as average self-test readings
+		aSTAvg[ii] /= 200;
+		gSTAvg[ii] /= 200;
+	}
+
+	// Configure the gyro and accelerometer for normal operation
+	write_byte(mpu_i2c_addr, ACCEL_CONFIG, 0x00);
+	write_byte(mpu_i2c_addr, GYRO_CONFIG, 0x00);
+	driver->delay(25);  // Delay a while to let the device stabilize
+
+	// Retrieve accelerometer and gyro factory Self-Test Code from USR_Reg
+	uint8_t self_test_data[6];
+	self_test_data[0] = read_byte(mpu_i2c_addr, SELF_TEST_X_ACCEL);  // X-axis accel self-test results
+	self_test_data[1] = read_byte(mpu_i2c_addr, SELF_TEST_Y_ACCEL);  // Y-axis accel self-test results
+	self_test_data[2] = read_byte(mpu_i2c_addr, SELF_TEST_Z_ACCEL);  // Z-axis accel self-test results
+	self_test_data[3] = read_byte(mpu_i2c_addr, SELF_TEST_X_GYRO);   // X-axis gyro self-test results
+	self_test_data[4] = read_byte(mpu_i2c_addr, SELF_TEST_Y_GYRO);   // Y-axis gyro self-test results
+	self_test_data[5] = read_byte(mpu_i2c_addr, SELF_TEST_Z_GYRO);   // Z-axis gyro self-test results
+
+	// Retrieve factory self-test value from self-test code reads
+	factoryTrim[0] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[0] - 1.0)));  // FT[Xa] factory trim calculation
+	factoryTrim[1] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[1] - 1.0)));  // FT[Ya] factory trim calculation
+	factoryTrim[2] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[2] - 1.0)));  // FT[Za] factory trim calculation
+	factoryTrim[3] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[3] - 1.0)));  // FT[Xg] factory trim calculation
+	factoryTrim[4] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[4] - 1.0)));  // FT[Yg] factory trim calculation
+	factoryTrim[5] = (float)(2620 / 1 << FS) * (pow(1.01, ((float)self_test_data[5] - 1.0)));  // FT[Zg] factory trim calculation
+
+	// Report results as a ratio of (STR - FT)/FT; the change from Factory Trim of the Self-Test Response
+	// To get percent, must multiply by 100
+	for (int i = 0; i < 3; i++) {
+		self_test_result[i] = 100.0 * ((float)(aSTAvg[i] - aAvg[i])) / factoryTrim[i] - 100.;          // Report percent differences
+		self_test_result[i + 3] = 100.0 * ((float)(gSTAvg[i] - gAvg[i])) / factoryTrim[i + 3] - 100.;  // Report percent differences
+	}
+
+	bool b = true;
+	for (uint8_t i = 0; i < 6; ++i) {
+		b &= fabs(self_test_result[i]) <= 14.f;
+	}
+	return b;
+}
+
+template <typename FilterT, typename DriverT>
+float BasicMPU<FilterT, DriverT>::get_acc_resolution(ACCEL_FS_SEL accel_af_sel) const {
+	switch (accel_af_sel) {
+		// Possible accelerometer scales (and their register bit settings) are:
+		// 2 Gs (00), 4 Gs (01), 8 Gs (10), and 16 Gs  (11).
+		// Here's a bit of an algorith to calculate DPS/(ADC tick) based on that 2-bit value:
+		case ACCEL_FS_SEL::A2G:
+			return 2.0 / 32768.0;
+		case ACCEL_FS_SEL::A4G:
+			return 4.0 / 32768.0;
+		case ACCEL_FS_SEL::A8G:
+			return 8.0 / 32768.0;
+		case ACCEL_FS_SEL::A16G:
+			return 16.0 / 32768.0;
+		default:
+			return 0.;
+	}
+}
+
+template <typename FilterT, typename DriverT>
+float BasicMPU<FilterT, DriverT>::get_gyro_resolution(GYRO_FS_SEL gyro_fs_sel) const {
+	switch (gyro_fs_sel) {
+		// Possible gyro scales (and their register bit settings) are:
+		// 250 DPS (00), 500 DPS (01), 1000 DPS (10), and 2000 DPS  (11).
+		// Here's a bit of an algorith to calculate DPS/(ADC tick) based on that 2-bit value:
+		case GYRO_FS_SEL::G250DPS:
+			return 250.0 / 32768.0;
+		case GYRO_FS_SEL::G500DPS:
+			return 500.0 / 32768.0;
+		case GYRO_FS_SEL::G1000DPS:
+			return 1000.0 / 32768.0;
+		case GYRO_FS_SEL::G2000DPS:
+			return 2000.0 / 32768.0;
+		default:
+			return 0.;
+	}
+}
+
+template <typename FilterT, typename DriverT>
+float BasicMPU<FilterT, DriverT>::get_mag_resolution(MAG_OUTPUT_BITS mag_output_bits) const {
+	switch (mag_output_bits) {
+		// Possible magnetometer scales (and their register bit settings) are:
+		// 14 bit resolution (0) and 16 bit resolution (1)
+		// Proper scale to return milliGauss
+		case MAG_OUTPUT_BITS::M14BITS:
+			return 10. * 4912. / 8190.0;
+		case MAG_OUTPUT_BITS::M16BITS:
+			return 10. * 4912. / 32760.0;
+		default:
+			return 0.;
+	}
+}
+
+template <typename FilterT, typename DriverT>
+uint32_t BasicMPU<FilterT, DriverT>::get_sample_period_us() const {
+	// with fchoice_b set the DLPF and SMPLRT_DIV are bypassed and the gyro runs at 32 kHz
+	if (setting.gyro_fchoice != 0x03)
+		return 31;
+	// internal sample rate is 8 kHz with DLPF_CFG = 7, 1 kHz otherwise
+	uint32_t internal_period_us = (setting.gyro_dlpf_cfg == GYRO_DLPF_CFG::DLPF_3600HZ) ? 125 : 1000;
+	return internal_period_us * (1 + (uint8_t)setting.fifo_sample_rate);
+}
+
+///////////////////////////////
+// I2C Functions
+///////////////////////////////
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::write_byte(uint8_t address, uint8_t reg, uint8_t data) {
+	uint8_t buf[2] = {reg, data};
+	driver->write(address, buf, 2);
+	if (address == mpu_i2c_addr)
+		shadow_store(reg, data);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::write_bytes(uint8_t address, uint8_t reg, uint8_t count, const uint8_t* data) {
+	uint8_t buf[1 + MAX_BURST_WRITE];
+	while (count > 0) {
+		const uint8_t n = count > MAX_BURST_WRITE ? MAX_BURST_WRITE : count;
+		buf[0] = reg;
+		for (uint8_t i = 0; i < n; ++i)
+			buf[1 + i] = data[i];
+		driver->write(address, buf, 1 + n);
+		if (address == mpu_i2c_addr) {
+			for (uint8_t i = 0; i < n; ++i)
+				shadow_store(reg + i, data[i]);
+		}
+		data += n;
+		count -= n;
+		if (address != mpu_i2c_addr || reg != FIFO_R_W)
+			reg += n;
+	}
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::modify_byte(uint8_t reg, uint8_t clear_bits, uint8_t set_bits) {
+	uint8_t c = read_byte(mpu_i2c_addr, reg);
+	uint8_t v = (c & ~clear_bits) | set_bits;
+	// a known register that already holds the value needs no write
+	if (v != c || shadow_index(reg) < 0)
+		write_byte(mpu_i2c_addr, reg, v);
+}
+
+template <typename FilterT, typename DriverT>
+uint8_t BasicMPU<FilterT, DriverT>::read_byte(uint8_t address, uint8_t reg) {
+	uint8_t result = 0;
+	if (address == mpu_i2c_addr) {
+		int8_t i = shadow_index(reg);
+		if (i >= 0 && (shadow_valid[i >> 3] & (1 << (i & 7))))
+			return shadow[i];
+	}
+	driver->write_read(address, &reg, 1, &result, 1);
+	if (address == mpu_i2c_addr)
+		shadow_store(reg, result);
+	return result;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::read_bytes(uint8_t address, uint8_t reg, uint16_t count, uint8_t* dest) {
+	// split at the transfer limit of the driver, FIFO_R_W is read again and
+	// other registers continue at the next address
+	const uint16_t limit = driver->max_read_size();
+	while (limit && count > limit) {
+		driver->write_read(address, &reg, 1, dest, limit);
+		dest += limit;
+		count -= limit;
+		if (address != mpu_i2c_addr || reg != FIFO_R_W)
+			reg += limit;
+	}
+	driver->write_read(address, &reg, 1, dest, count);
+}
+
+template <typename FilterT, typename DriverT>
+int8_t BasicMPU<FilterT, DriverT>::shadow_index(uint8_t reg) const {
+	switch (reg) {
+		case I2C_SLV4_CTRL:      // EN clears itself
+		case I2C_SLV4_DI:
+		case I2C_MST_STATUS:
+		case SIGNAL_PATH_RESET:  // self clearing
+		case FIFO_COUNTH:
+		case FIFO_COUNTL:
+		case FIFO_R_W:
+		case WHO_AM_I_MPU9250:   // isConnected() has to ask the device
+			return -1;
+		default:
+			break;
+	}
+	if (reg >= XG_OFFSET_H && reg <= INT_ENABLE)
+		return reg - XG_OFFSET_H;
+	if (reg >= I2C_MST_DELAY_CTRL && reg <= ZA_OFFSET_L)
+		return (INT_ENABLE - XG_OFFSET_H + 1) + (reg - I2C_MST_DELAY_CTRL);
+	return -1;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::shadow_store(uint8_t reg, uint8_t data) {
+	if (reg == PWR_MGMT_1 && (data & PWR_MGMT_1_H_RESET)) {
+		shadow_after_reset();
+		return;
+	}
+	if (reg == USER_CTRL)
+		data &= ~0x0F;  // DMP_RST, FIFO_RST, I2C_MST_RST and SIG_COND_RST clear themselves
+	int8_t i = shadow_index(reg);
+	if (i < 0)
+		return;
+	shadow[i] = data;
+	shadow_valid[i >> 3] |= 1 << (i & 7);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::shadow_after_reset() {
+	// every register resets to 0 except PWR_MGMT_1 (0x01), and the accel
+	// offsets which reload their factory trim
+	for (uint8_t i = 0; i < SHADOW_SIZE; ++i)
+		shadow[i] = 0x00;
+	for (uint8_t i = 0; i < sizeof(shadow_valid); ++i)
+		shadow_valid[i] = 0xFF;
+	shadow_valid[sizeof(shadow_valid) - 1] = (1 << (SHADOW_SIZE - 8 * (sizeof(shadow_valid) - 1))) - 1;
+	for (uint8_t reg = XA_OFFSET_H; reg <= ZA_OFFSET_L; ++reg) {
+		int8_t i = shadow_index(reg);
+		shadow_valid[i >> 3] &= ~(1 << (i & 7));
+	}
+	shadow[shadow_index(PWR_MGMT_1)] = PWR_MGMT_1_CLKSEL(1);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::invalidateRegisterCache() {
+	for (uint8_t i = 0; i < sizeof(shadow_valid); ++i)
+		shadow_valid[i] = 0;
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::mag_write_byte(uint8_t reg, uint8_t data) {
+	if (!setting.mag_via_i2c_master) {
+		write_byte(AK8963_ADDRESS, reg, data);
+		return;
+	}
+	// I2C_SLV4_ADDR, _REG, _DO and _CTRL are consecutive
+	const uint8_t slv4[4] = {AK8963_ADDRESS, reg, data, I2C_SLV4_CTRL_EN};
+	write_bytes(mpu_i2c_addr, I2C_SLV4_ADDR, 4, slv4);
+	wait_slv4_done();
+}
+
+template <typename FilterT, typename DriverT>
+uint8_t BasicMPU<FilterT, DriverT>::mag_read_byte(uint8_t reg) {
+	if (!setting.mag_via_i2c_master)
+		return read_byte(AK8963_ADDRESS, reg);
+	const uint8_t slv4[4] = {I2C_SLV_ADDR_RW | AK8963_ADDRESS, reg, 0x00, I2C_SLV4_CTRL_EN};
+	write_bytes(mpu_i2c_addr, I2C_SLV4_ADDR, 4, slv4);
+	if (!wait_slv4_done())
+		return 0;
+	return read_byte(mpu_i2c_addr, I2C_SLV4_DI);
+}
+
+template <typename FilterT, typename DriverT>
+void BasicMPU<FilterT, DriverT>::mag_read_bytes(uint8_t reg, uint8_t count, uint8_t* dest) {
+	if (!setting.mag_via_i2c_master) {
+		read_bytes(AK8963_ADDRESS, reg, count, dest);
+		return;
+	}
+	// SLV4 transfers a single byte at a time
+	for (uint8_t i = 0; i < count; ++i)
+		dest[i] = mag_read_byte(reg + i);
+}
+
+template <typename FilterT, typename DriverT>
+bool BasicMPU<FilterT, DriverT>::wait_slv4_done() {
+	for (uint8_t i = 0; i < 10; ++i) {
+		if (read_byte(mpu_i2c_addr, I2C_MST_STATUS) & I2C_MST_STATUS_SLV4_DONE)
+			return true;
+		driver->delay(1);
+	}
+	return false;
+}
+
+} // namespace MPU9250
+
+#endif  // MPU9250IMPL_H
@@ -0,0 +1,99 @@
+#ifndef ONLINECALIBRATION_H
+#define ONLINECALIBRATION_H
+#include <stdint.h>
+
+namespace MPU9250 {
+
+// Background hard/soft iron calibration of the magnetometer.
+// Fits an axis aligned ellipsoid
+//   x^2 + t0 y^2 + t1 z^2 + t2 x + t3 y + t4 z + t5 = 0
+// to the raw field by recursive least squares with exponential forgetting,
+// so it costs the same fixed time and memory per sample however long it
+// runs, and follows slow changes of the field. Samples closer than
+// min_step to the previously used one carry no new information and are
+// skipped, which also keeps the covariance from winding up while the
+// device rests. See BasicMPU::attachMagCalibrator().
+class MagCalibrator {
+public:
+	// forgetting factor per used sample, 1 remembers everything
+	float forgetting {0.995f};
+	float min_step {20.f};            // [mG]
+	uint16_t min_samples {150};       // used samples before the first solution
+	// every axis has to be seen over coverage * its radius on either side
+	// of the center before the fit is trusted
+	float coverage {0.7f};
+	float tolerance {0.01f};          // center change per sample, relative to the radius
+
+	MagCalibrator() { reset(); }
+	void reset();
+
+	// m: field [mG] with the factory sensitivity adjustment applied and no
+	// bias or scale correction. Returns true when there is a new solution.
+	bool update(float mx, float my, float mz);
+
+	bool isConverged() const { return converged; }
+	uint32_t sampleCount() const { return n_used; }
+	// in the MPU convention: corrected = (raw - bias) * scale
+	const float* getBias() const { return bias; }    // [mG]
+	const float* getScale() const { return scale; }
+
+private:
+	static constexpr uint8_t N {6};
+	// the fit runs in G, so that the squares stay well conditioned in float
+	static constexpr float UNIT {1e-3f};
+	static constexpr float P_INIT {100.f};
+	static constexpr float P_TRACE_MAX {1e4f};
+
+	float theta[N];
+	float P[N][N];
+	float last[3];
+	float lo[3], hi[3];  // seen range [G]
+	float center[3];     // [G]
+	float bias[3];
+	float scale[3];
+	uint32_t n_used;
+	bool converged;
+
+	bool solve(float* c, float* r) const;
+};
+
+// Gyro bias tracking while the device is at rest.
+// Exponentially weighted mean and variance of accel and gyro detect rest,
+// during which the bias estimate follows the gyro output with weight
+// bias_alpha per sample. A steady rotation has low variance too, so rates
+// above max_rate never count as rest. See
+// BasicMPU::attachGyroBiasEstimator().
+class GyroBiasEstimator {
+public:
+	float alpha {0.05f};            // weight of the rest detection trackers
+	float gyro_threshold {0.3f};    // rest: standard deviation [deg/s] below
+	float acc_threshold {0.01f};    // and [g] below
+	float max_rate {5.f};           // [deg/s]
+	uint16_t hold_samples {100};    // at rest this long before the bias moves
+	float bias_alpha {0.005f};
+
+	GyroBiasEstimator() { reset(); }
+	void reset();
+
+	// acc [g] and gyro [deg/s] without the estimated bias removed. Returns
+	// true when the sample was taken at rest and refined the bias.
+	bool update(const float* acc, const float* gyro);
+
+	bool isStationary() const { return n_still >= hold_samples; }
+	const float* getBias() const { return bias; }  // [deg/s]
+	// the gyro output moved by -d (e.g. an offset register changed)
+	void shift(const float* d);
+
+private:
+	float acc_mean[3];
+	float gyro_mean[3];
+	float acc_var;   // summed over the axes
+	float gyro_var;
+	float bias[3];
+	uint16_t n_still;
+	bool has_mean;
+};
+
+} // namespace MPU9250
+
+#endif  // ONLINECALIBRATION_H
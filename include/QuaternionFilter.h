@@ -11,30 +11,54 @@ enum class QuatFilterSel {
 	MAHONY,
 };
 
+template <typename FilterT, typename DriverT>
+class BasicMPU;
+
 class Filter {
 private:
-	double deltaT{0.};
-	uint32_t newTime{0}, oldTime{0};
+	uint32_t last_time_us {0};
+	bool has_time {false};
+	// BasicMPU calls update_impl() with the dt of the samples
+	template <typename FilterT, typename DriverT>
+	friend class BasicMPU;
 protected:
 	virtual void update_impl(float ax, float ay, float az,
                            float gx, float gy, float gz,
                            float mx, float my, float mz,
                            double deltaT, float* q) =0;
 public:
+	// time_us: measurement time on a monotonic clock (e.g. Sample::timestamp),
+	// wrapping at 2^32. The first call only initializes the time base.
+	void update(float ax, float ay, float az,
+              float gx, float gy, float gz,
+              float mx, float my, float mz,
+              uint32_t time_us, float* q);
+#ifdef ARDUINO
+	// the time from micros(), as before the timestamped update()
 	void update(float ax, float ay, float az,
               float gx, float gy, float gz,
               float mx, float my, float mz, float* q);
+#endif
+
+	// Internal state worth keeping across a restart (e.g. integral terms),
+	// see BasicMPU::exportState(). save_state() writes it little endian and
+	// returns its size, load_state() rejects a size it does not expect.
+	static constexpr uint8_t MAX_STATE_SIZE {16};
+	virtual uint8_t save_state(uint8_t* /* dest */) const { return 0; }
+	virtual bool load_state(const uint8_t* /* src */, uint8_t size) { return size == 0; }
 };
 
-class SimpleFilter : public Filter {
-protected:
+class SimpleFilter final : public Filter {
+public:
 	virtual void update_impl(float ax, float ay, float az,
                            float gx, float gy, float gz,
                            float mx, float my, float mz,
                            double deltaT, float* q) override;
 };
 
-class MadgwickFilter : public Filter {
+// Madgwick gradient descent filter, computed in Real precision.
+template <typename Real>
+class BasicMadgwickFilter : public Filter {
 private:
 	// gyroscope measurement error in rads/s (start at 40 deg/s)
 	float GyroMeasError;
@@ -46,14 +70,24 @@ private:
 	// usually set to a small or zero value
 	float zeta;
 public:
-	MadgwickFilter();
+	BasicMadgwickFilter();
+	// beta = sqrt(3/4) * error, error in rad/s
+	void setGyroMeasError(float error);
+	void setBeta(float b) { beta = b; }
+	float getBeta() const { return beta; }
 	virtual void update_impl(float ax, float ay, float az,
                            float gx, float gy, float gz,
                            float mx, float my, float mz,
                            double deltaT, float* q) override;
 };
 
-class MahonyFilter : public Filter {
+// double precision, as before the float kernel
+using MadgwickFilter = BasicMadgwickFilter<double>;
+// single precision, opt in on single precision FPUs (Cortex-M4F, ESP32)
+// where double is soft-float
+using MadgwickFilterFloat = BasicMadgwickFilter<float>;
+
+class MahonyFilter final : public Filter {
 	// Mahony accelleration filter
 	// Mahony scheme uses proportional and integral filtering on
 	// the error between estimated reference vector (gravity) and measured one.
@@ -68,11 +102,19 @@ class MahonyFilter : public Filter {
 private:
 	float Kp = 30.0;
 	float Ki = 0.0;
+	// integral feedback terms, per instance
+	float ix {0.f}, iy {0.f}, iz {0.f};
 public:
+	// Ki = 0 disables the integral feedback
+	void setGains(float kp, float ki) { Kp = kp; Ki = ki; }
+	float getKp() const { return Kp; }
+	float getKi() const { return Ki; }
 	virtual void update_impl(float ax, float ay, float az,
                            float gx, float gy, float gz,
                            float mx, float my, float mz,
                            double deltaT, float* q) override;
+	virtual uint8_t save_state(uint8_t* dest) const override;
+	virtual bool load_state(const uint8_t* src, uint8_t size) override;
 };
 
 } // namespace MPU9250
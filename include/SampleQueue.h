@@ -0,0 +1,97 @@
+#ifndef SAMPLEQUEUE_H
+#define SAMPLEQUEUE_H
+#include <stdint.h>
+#if !defined(__AVR__)
+#include <atomic>
+#endif
+
+namespace MPU9250 {
+
+// Lock-free ring buffer for one producer and one consumer, over storage
+// owned by the caller, which holds capacity - 1 elements. The producer
+// (e.g. update() in an ISR or a bus thread) and the consumer (a task or
+// the main loop) may run concurrently without locking: each index is
+// written by one side only and published with release/acquire ordering.
+// A push into a full queue drops the new element and counts an overflow.
+//
+// AVR has no <atomic>, there single byte volatile accesses are atomic, so
+// the capacity is limited to 255 and overflows() may be read torn while
+// the producer runs.
+template <typename T>
+class SPSCQueue {
+public:
+#if defined(__AVR__)
+	using index_t = uint8_t;
+#else
+	using index_t = uint16_t;
+#endif
+
+	SPSCQueue(T* storage, index_t capacity) : buf(storage), cap(capacity) {}
+
+	// producer side
+	bool push(const T& v) {
+		const index_t h = load_relaxed(head);
+		const index_t next = (h + 1 == cap) ? 0 : h + 1;
+		if (next == load_acquire(tail)) {
+			store_release(n_overflows, (uint32_t)(load_relaxed(n_overflows) + 1));
+			return false;
+		}
+		buf[h] = v;
+		store_release(head, next);
+		return true;
+	}
+
+	// consumer side
+	bool pop(T& v) {
+		const index_t t = load_relaxed(tail);
+		if (t == load_acquire(head))
+			return false;
+		v = buf[t];
+		store_release(tail, (index_t)((t + 1 == cap) ? 0 : t + 1));
+		return true;
+	}
+
+	// either side, a snapshot
+	index_t size() const {
+		const index_t h = load_acquire(head);
+		const index_t t = load_acquire(tail);
+		return (h >= t) ? h - t : cap - t + h;
+	}
+	bool empty() const { return size() == 0; }
+	index_t capacity() const { return cap - 1; }
+	// elements dropped because the queue was full, only ever increases
+	uint32_t overflows() const { return load_acquire(n_overflows); }
+
+private:
+	T* buf;
+	const index_t cap;
+
+#if defined(__AVR__)
+	volatile index_t head {0};
+	volatile index_t tail {0};
+	volatile uint32_t n_overflows {0};
+
+	template <typename U> static U load_relaxed(const volatile U& x) { return x; }
+	template <typename U> static U load_acquire(const volatile U& x) {
+		U v = x;
+		asm volatile("" ::: "memory");
+		return v;
+	}
+	template <typename U> static void store_release(volatile U& x, U v) {
+		asm volatile("" ::: "memory");
+		x = v;
+	}
+#else
+	std::atomic<index_t> head {0};
+	std::atomic<index_t> tail {0};
+	std::atomic<uint32_t> n_overflows {0};
+
+	template <typename U> static U load_relaxed(const std::atomic<U>& x) { return x.load(std::memory_order_relaxed); }
+	template <typename U> static U load_acquire(const std::atomic<U>& x) { return x.load(std::memory_order_acquire); }
+	template <typename U> static void store_release(std::atomic<U>& x, U v) { x.store(v, std::memory_order_release); }
+#endif
+};
+
+} // namespace MPU9250
+
+#endif  // SAMPLEQUEUE_H
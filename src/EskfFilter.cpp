@@ -0,0 +1,171 @@
+#include <EskfFilter.h>
+#include <MPU9250Utility.h>
+
+namespace MPU9250 {
+
+namespace {
+
+constexpr float INITIAL_ANGLE_VAR {0.25f};  // (0.5 rad)^2
+constexpr float INITIAL_BIAS_VAR {1e-4f};   // (0.01 rad/s)^2, about 0.6 deg/s
+
+// v_b = R^T v_w, R the rotation of q (body to world)
+Vector3<> to_body(const float* q, const Vector3<>& v) {
+	const float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	Vector3<> b;
+	b[0] = (1.f - 2.f * (q2 * q2 + q3 * q3)) * v[0] + 2.f * (q1 * q2 + q0 * q3) * v[1] + 2.f * (q1 * q3 - q0 * q2) * v[2];
+	b[1] = 2.f * (q1 * q2 - q0 * q3) * v[0] + (1.f - 2.f * (q1 * q1 + q3 * q3)) * v[1] + 2.f * (q2 * q3 + q0 * q1) * v[2];
+	b[2] = 2.f * (q1 * q3 + q0 * q2) * v[0] + 2.f * (q2 * q3 - q0 * q1) * v[1] + (1.f - 2.f * (q1 * q1 + q2 * q2)) * v[2];
+	return b;
+}
+
+// v_w = R v_b
+Vector3<> to_world(const float* q, const Vector3<>& v) {
+	const float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	Vector3<> w;
+	w[0] = (1.f - 2.f * (q2 * q2 + q3 * q3)) * v[0] + 2.f * (q1 * q2 - q0 * q3) * v[1] + 2.f * (q1 * q3 + q0 * q2) * v[2];
+	w[1] = 2.f * (q1 * q2 + q0 * q3) * v[0] + (1.f - 2.f * (q1 * q1 + q3 * q3)) * v[1] + 2.f * (q2 * q3 - q0 * q1) * v[2];
+	w[2] = 2.f * (q1 * q3 - q0 * q2) * v[0] + 2.f * (q2 * q3 + q0 * q1) * v[1] + (1.f - 2.f * (q1 * q1 + q2 * q2)) * v[2];
+	return w;
+}
+
+// q = q x [1, r/2], normalized: a small rotation r in the body frame
+void rotate(float* q, float rx, float ry, float rz) {
+	rx *= 0.5f;
+	ry *= 0.5f;
+	rz *= 0.5f;
+	const float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	q[0] += -q1 * rx - q2 * ry - q3 * rz;
+	q[1] += q0 * rx + q2 * rz - q3 * ry;
+	q[2] += q0 * ry - q1 * rz + q3 * rx;
+	q[3] += q0 * rz + q1 * ry - q2 * rx;
+	const float recipNorm = inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	for (uint8_t i = 0; i < 4; ++i)
+		q[i] *= recipNorm;
+}
+
+inline Matrix3<> symmetric(const Matrix3<>& a) {
+	return (a + a.transposed()) * 0.5f;
+}
+
+} // namespace
+
+EskfFilter::EskfFilter() {
+	setGyroNoise(0.002f, 2e-5f);
+	setMeasurementNoise(0.03f, 0.05f);
+	reset();
+}
+
+void EskfFilter::setGyroNoise(float noise, float bias_walk) {
+	gyro_var_density = noise * noise;
+	bias_var_density = bias_walk * bias_walk;
+}
+
+void EskfFilter::setMeasurementNoise(float acc, float mag) {
+	acc_var = acc * acc;
+	mag_var = mag * mag;
+}
+
+void EskfFilter::reset() {
+	p_tt = Matrix3<>::diagonal(INITIAL_ANGLE_VAR);
+	p_tb = Matrix3<>::zeros();
+	p_bb = Matrix3<>::diagonal(INITIAL_BIAS_VAR);
+	bias[0] = bias[1] = bias[2] = 0.f;
+}
+
+void EskfFilter::update_impl(
+		float ax, float ay, float az,
+		float gx, float gy, float gz,
+		float mx, float my, float mz,
+		double deltaT, float* q)
+{
+	const float dt = deltaT;
+
+	// Predict: the quaternion with the bias corrected rate, and the error
+	// covariance with F = [I - [w dt]x, -I dt; 0, I] in 3x3 blocks
+	Vector3<> w;
+	w[0] = gx - bias[0];
+	w[1] = gy - bias[1];
+	w[2] = gz - bias[2];
+	rotate(q, w[0] * dt, w[1] * dt, w[2] * dt);
+
+	const Matrix3<> f = Matrix3<>::identity() - skew(w * dt);
+	const Matrix3<> m1 = f * p_tt - p_tb.transposed() * dt;
+	const Matrix3<> m2 = f * p_tb - p_bb * dt;
+	p_tt = symmetric(m1.mul_transposed(f) - m2 * dt) + Matrix3<>::diagonal(gyro_var_density * dt);
+	p_tb = m2;
+	p_bb += Matrix3<>::diagonal(bias_var_density * dt);
+
+	// Gravity, trusted less the more |a| differs from 1 g
+	const float a_norm = ax * ax + ay * ay + az * az;
+	if (a_norm > 0.f) {
+		const float recipNorm = inv_sqrt(a_norm);
+		const float deviation = a_norm * recipNorm - 1.f;
+		Vector3<> a;
+		a[0] = ax * recipNorm;
+		a[1] = ay * recipNorm;
+		a[2] = az * recipNorm;
+		Vector3<> down = Vector3<>::zeros();
+		down[2] = 1.f;
+		const Vector3<> predicted = to_body(q, down);
+		correct(a - predicted, predicted, acc_var * (1.f + 100.f * deviation * deviation), q);
+	}
+
+	// Heading, against the measured field turned into the x-z plane of the
+	// earth frame, so that its inclination does not matter
+	const float m_norm = mx * mx + my * my + mz * mz;
+	if (m_norm > 0.f) {
+		const float recipNorm = inv_sqrt(m_norm);
+		Vector3<> m;
+		m[0] = mx * recipNorm;
+		m[1] = my * recipNorm;
+		m[2] = mz * recipNorm;
+		Vector3<> h = to_world(q, m);
+		h[0] = sqrtf(h[0] * h[0] + h[1] * h[1]);
+		h[1] = 0.f;
+		const Vector3<> predicted = to_body(q, h);
+		correct(m - predicted, predicted, mag_var, q);
+	}
+}
+
+// Measurement update for a direction: residual = measured - predicted body
+// vector, whose Jacobian for the rotation error is H = [predicted]x (and
+// zero for the bias). Both use the 3x3 blocks, nothing of size 6.
+void EskfFilter::correct(const Vector3<>& residual, const Vector3<>& predicted, float var, float* q) {
+	const Matrix3<> h = skew(predicted);
+	const Matrix3<> pht_t = p_tt.mul_transposed(h);        // P_tt H^T
+	const Matrix3<> pht_b = (h * p_tb).transposed();       // P_bt H^T
+	Matrix3<> s_inv;
+	if (!inverse_symmetric(h * pht_t + Matrix3<>::diagonal(var), s_inv))
+		return;
+	const Matrix3<> k_t = pht_t * s_inv;
+	const Matrix3<> k_b = pht_b * s_inv;
+
+	p_tt = symmetric(p_tt - k_t.mul_transposed(pht_t));
+	p_tb -= k_t.mul_transposed(pht_b);
+	p_bb = symmetric(p_bb - k_b.mul_transposed(pht_b));
+
+	// inject the error into the nominal state, the error is zero again
+	const Vector3<> d_theta = k_t * residual;
+	const Vector3<> d_bias = k_b * residual;
+	rotate(q, d_theta[0], d_theta[1], d_theta[2]);
+	for (uint8_t i = 0; i < 3; ++i)
+		bias[i] += d_bias[i];
+}
+
+uint8_t EskfFilter::save_state(uint8_t* dest) const {
+	dest = put_f32(dest, bias[0]);
+	dest = put_f32(dest, bias[1]);
+	put_f32(dest, bias[2]);
+	return 12;
+}
+
+bool EskfFilter::load_state(const uint8_t* src, uint8_t size) {
+	if (size != 12)
+		return false;
+	src = get_f32(src, bias[0]);
+	src = get_f32(src, bias[1]);
+	get_f32(src, bias[2]);
+	return true;
+}
+
+} // namespace MPU9250
@@ -0,0 +1,311 @@
+#include <FilterBank.h>
+
+#if !defined(MPU9250_NO_SIMD)
+#if defined(__AVX__)
+#define MPU9250_BANK_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define MPU9250_BANK_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+// AArch64 only, ARMv7 NEON has no vector divide and square root
+#define MPU9250_BANK_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace MPU9250 {
+
+namespace {
+
+// V: a vector of V::WIDTH floats, one instance per lane, M: a lane mask.
+// The operators round like scalar float code, and the kernels below are
+// written with the same expressions in the same order as the Filter
+// classes, so every lane gets the scalar result.
+#if defined(MPU9250_BANK_AVX)
+
+struct V {
+	static constexpr uint8_t WIDTH {8};
+	__m256 v;
+	V(__m256 x) : v(x) {}
+	V(float x) : v(_mm256_set1_ps(x)) {}
+	static V load(const float* p) { return _mm256_load_ps(p); }
+	void store(float* p) const { _mm256_store_ps(p, v); }
+};
+struct M { __m256 m; };
+
+inline V operator+(V a, V b) { return _mm256_add_ps(a.v, b.v); }
+inline V operator-(V a, V b) { return _mm256_sub_ps(a.v, b.v); }
+inline V operator*(V a, V b) { return _mm256_mul_ps(a.v, b.v); }
+inline V operator/(V a, V b) { return _mm256_div_ps(a.v, b.v); }
+inline V operator-(V a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.f)); }
+inline V vsqrt(V a) { return _mm256_sqrt_ps(a.v); }
+inline M operator!=(V a, V b) { return M {_mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ)}; }
+inline M operator>(V a, V b) { return M {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline M operator&(M a, M b) { return M {_mm256_and_ps(a.m, b.m)}; }
+inline V select(M m, V a, V b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+#elif defined(MPU9250_BANK_SSE2)
+
+struct V {
+	static constexpr uint8_t WIDTH {4};
+	__m128 v;
+	V(__m128 x) : v(x) {}
+	V(float x) : v(_mm_set1_ps(x)) {}
+	static V load(const float* p) { return _mm_load_ps(p); }
+	void store(float* p) const { _mm_store_ps(p, v); }
+};
+struct M { __m128 m; };
+
+inline V operator+(V a, V b) { return _mm_add_ps(a.v, b.v); }
+inline V operator-(V a, V b) { return _mm_sub_ps(a.v, b.v); }
+inline V operator*(V a, V b) { return _mm_mul_ps(a.v, b.v); }
+inline V operator/(V a, V b) { return _mm_div_ps(a.v, b.v); }
+inline V operator-(V a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.f)); }
+inline V vsqrt(V a) { return _mm_sqrt_ps(a.v); }
+inline M operator!=(V a, V b) { return M {_mm_cmpneq_ps(a.v, b.v)}; }
+inline M operator>(V a, V b) { return M {_mm_cmpgt_ps(a.v, b.v)}; }
+inline M operator&(M a, M b) { return M {_mm_and_ps(a.m, b.m)}; }
+inline V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+
+#elif defined(MPU9250_BANK_NEON)
+
+struct V {
+	static constexpr uint8_t WIDTH {4};
+	float32x4_t v;
+	V(float32x4_t x) : v(x) {}
+	V(float x) : v(vdupq_n_f32(x)) {}
+	static V load(const float* p) { return vld1q_f32(p); }
+	void store(float* p) const { vst1q_f32(p, v); }
+};
+struct M { uint32x4_t m; };
+
+inline V operator+(V a, V b) { return vaddq_f32(a.v, b.v); }
+inline V operator-(V a, V b) { return vsubq_f32(a.v, b.v); }
+inline V operator*(V a, V b) { return vmulq_f32(a.v, b.v); }
+inline V operator/(V a, V b) { return vdivq_f32(a.v, b.v); }
+inline V operator-(V a) { return vnegq_f32(a.v); }
+inline V vsqrt(V a) { return vsqrtq_f32(a.v); }
+inline M operator!=(V a, V b) { return M {vmvnq_u32(vceqq_f32(a.v, b.v))}; }
+inline M operator>(V a, V b) { return M {vcgtq_f32(a.v, b.v)}; }
+inline M operator&(M a, M b) { return M {vandq_u32(a.m, b.m)}; }
+inline V select(M m, V a, V b) { return vbslq_f32(m.m, a.v, b.v); }
+
+#else
+
+struct V {
+	static constexpr uint8_t WIDTH {1};
+	float v;
+	V(float x) : v(x) {}
+	static V load(const float* p) { return *p; }
+	void store(float* p) const { *p = v; }
+};
+struct M { bool m; };
+
+inline V operator+(V a, V b) { return a.v + b.v; }
+inline V operator-(V a, V b) { return a.v - b.v; }
+inline V operator*(V a, V b) { return a.v * b.v; }
+inline V operator/(V a, V b) { return a.v / b.v; }
+inline V operator-(V a) { return -a.v; }
+inline V vsqrt(V a) { return sqrtf(a.v); }
+inline M operator!=(V a, V b) { return M {a.v != b.v}; }
+inline M operator>(V a, V b) { return M {a.v > b.v}; }
+inline M operator&(M a, M b) { return M {a.m && b.m}; }
+inline V select(M m, V a, V b) { return m.m ? a : b; }
+
+#endif
+
+// mixed with float constants, as in the scalar code
+inline V operator+(float a, V b) { return V(a) + b; }
+inline V operator-(float a, V b) { return V(a) - b; }
+inline V operator*(float a, V b) { return V(a) * b; }
+inline V operator-(V a, float b) { return a - V(b); }
+
+// 1.0f / sqrtf(x), as inv_sqrt() without MPU9250_FAST_MATH
+inline V vinv_sqrt(V x) { return V(1.f) / vsqrt(x); }
+
+// One block of MadgwickFilterFloat::update_impl()
+void madgwick_block(float* const* f, size_t i, V dt) {
+	const V q0 = V::load(&f[BANK_Q0][i]), q1 = V::load(&f[BANK_Q1][i]);
+	const V q2 = V::load(&f[BANK_Q2][i]), q3 = V::load(&f[BANK_Q3][i]);
+	V ax = V::load(&f[BANK_AX][i]), ay = V::load(&f[BANK_AY][i]), az = V::load(&f[BANK_AZ][i]);
+	const V gx = V::load(&f[BANK_GX][i]), gy = V::load(&f[BANK_GY][i]), gz = V::load(&f[BANK_GZ][i]);
+	V mx = V::load(&f[BANK_MX][i]), my = V::load(&f[BANK_MY][i]), mz = V::load(&f[BANK_MZ][i]);
+	const V beta = V::load(&f[BANK_COMMON_FIELDS][i]);
+
+	// Rate of change of quaternion from gyroscope
+	V qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	V qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	V qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	V qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+	// Normalise measurements, lanes without one keep their quaternion
+	const V a_norm = ax * ax + ay * ay + az * az;
+	const V m_norm = mx * mx + my * my + mz * mz;
+	const M valid = (a_norm != V(0.f)) & (m_norm != V(0.f));
+	V recipNorm = vinv_sqrt(a_norm);
+	ax = ax * recipNorm;
+	ay = ay * recipNorm;
+	az = az * recipNorm;
+	recipNorm = vinv_sqrt(m_norm);
+	mx = mx * recipNorm;
+	my = my * recipNorm;
+	mz = mz * recipNorm;
+
+	// Auxiliary variables to avoid repeated arithmetic
+	const V _2q0mx = 2.0f * q0 * mx;
+	const V _2q0my = 2.0f * q0 * my;
+	const V _2q0mz = 2.0f * q0 * mz;
+	const V _2q1mx = 2.0f * q1 * mx;
+	const V _2q0 = 2.0f * q0;
+	const V _2q1 = 2.0f * q1;
+	const V _2q2 = 2.0f * q2;
+	const V _2q3 = 2.0f * q3;
+	const V _2q0q2 = 2.0f * q0 * q2;
+	const V _2q2q3 = 2.0f * q2 * q3;
+	const V q0q0 = q0 * q0;
+	const V q0q1 = q0 * q1;
+	const V q0q2 = q0 * q2;
+	const V q0q3 = q0 * q3;
+	const V q1q1 = q1 * q1;
+	const V q1q2 = q1 * q2;
+	const V q1q3 = q1 * q3;
+	const V q2q2 = q2 * q2;
+	const V q2q3 = q2 * q3;
+	const V q3q3 = q3 * q3;
+
+	// Reference direction of Earth's magnetic field
+	const V hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+	const V hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+	const V _2bx = vsqrt(hx * hx + hy * hy);
+	const V _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+	const V _4bx = 2.0f * _2bx;
+	const V _4bz = 2.0f * _2bz;
+
+	// Gradient decent algorithm corrective step
+	V s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	V s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	V s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	V s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+	recipNorm = vinv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);  // normalise step magnitude
+	s0 = s0 * recipNorm;
+	s1 = s1 * recipNorm;
+	s2 = s2 * recipNorm;
+	s3 = s3 * recipNorm;
+
+	// Apply feedback step
+	qDot1 = qDot1 - beta * s0;
+	qDot2 = qDot2 - beta * s1;
+	qDot3 = qDot3 - beta * s2;
+	qDot4 = qDot4 - beta * s3;
+
+	// Integrate rate of change of quaternion to yield quaternion
+	V n0 = q0 + qDot1 * dt;
+	V n1 = q1 + qDot2 * dt;
+	V n2 = q2 + qDot3 * dt;
+	V n3 = q3 + qDot4 * dt;
+
+	// Normalise quaternion
+	recipNorm = vinv_sqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+	select(valid, n0 * recipNorm, q0).store(&f[BANK_Q0][i]);
+	select(valid, n1 * recipNorm, q1).store(&f[BANK_Q1][i]);
+	select(valid, n2 * recipNorm, q2).store(&f[BANK_Q2][i]);
+	select(valid, n3 * recipNorm, q3).store(&f[BANK_Q3][i]);
+}
+
+// One block of MahonyFilter::update_impl(), in float where the Filter
+// computes the dt products in double
+void mahony_block(float* const* f, size_t i, V dt) {
+	const V q0 = V::load(&f[BANK_Q0][i]), q1 = V::load(&f[BANK_Q1][i]);
+	const V q2 = V::load(&f[BANK_Q2][i]), q3 = V::load(&f[BANK_Q3][i]);
+	V ax = V::load(&f[BANK_AX][i]), ay = V::load(&f[BANK_AY][i]), az = V::load(&f[BANK_AZ][i]);
+	V gx = V::load(&f[BANK_GX][i]), gy = V::load(&f[BANK_GY][i]), gz = V::load(&f[BANK_GZ][i]);
+	const V Kp = V::load(&f[BANK_COMMON_FIELDS][i]), Ki = V::load(&f[BANK_COMMON_FIELDS + 1][i]);
+	V ix = V::load(&f[BANK_COMMON_FIELDS + 2][i]);
+	V iy = V::load(&f[BANK_COMMON_FIELDS + 3][i]);
+	V iz = V::load(&f[BANK_COMMON_FIELDS + 4][i]);
+
+	// Compute feedback only if accelerometer measurement valid
+	const V tmp = ax * ax + ay * ay + az * az;
+	const M valid = tmp > V(0.f);
+	const V recipNorm = vinv_sqrt(tmp);
+	ax = ax * recipNorm;
+	ay = ay * recipNorm;
+	az = az * recipNorm;
+
+	// Estimated direction of gravity in the body frame (factor of two divided out)
+	const V vx = q1 * q3 - q0 * q2;
+	const V vy = q0 * q1 + q2 * q3;
+	const V vz = q0 * q0 - 0.5f + q3 * q3;
+
+	// Error is cross product between estimated and measured direction of gravity in body frame
+	const V ex = (ay * vz - az * vy);
+	const V ey = (az * vx - ax * vz);
+	const V ez = (ax * vy - ay * vx);
+
+	// integral feedback where enabled, then proportional feedback
+	const M integrate = valid & (Ki > V(0.f));
+	ix = select(integrate, ix + Ki * ex * dt, ix);
+	iy = select(integrate, iy + Ki * ey * dt, iy);
+	iz = select(integrate, iz + Ki * ez * dt, iz);
+	gx = select(integrate, gx + ix, gx);
+	gy = select(integrate, gy + iy, gy);
+	gz = select(integrate, gz + iz, gz);
+	gx = select(valid, gx + Kp * ex, gx);
+	gy = select(valid, gy + Kp * ey, gy);
+	gz = select(valid, gz + Kp * ez, gz);
+
+	// Integrate rate of change of quaternion, q cross gyro term
+	const V half_dt = 0.5f * dt;
+	gx = gx * half_dt;
+	gy = gy * half_dt;
+	gz = gz * half_dt;
+	const V n0 = q0 + (-q1 * gx - q2 * gy - q3 * gz);
+	const V n1 = q1 + (q0 * gx + q2 * gz - q3 * gy);
+	const V n2 = q2 + (q0 * gy - q1 * gz + q3 * gx);
+	const V n3 = q3 + (q0 * gz + q1 * gy - q2 * gx);
+
+	// renormalise quaternion
+	const V r = vinv_sqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+	(n0 * r).store(&f[BANK_Q0][i]);
+	(n1 * r).store(&f[BANK_Q1][i]);
+	(n2 * r).store(&f[BANK_Q2][i]);
+	(n3 * r).store(&f[BANK_Q3][i]);
+	ix.store(&f[BANK_COMMON_FIELDS + 2][i]);
+	iy.store(&f[BANK_COMMON_FIELDS + 3][i]);
+	iz.store(&f[BANK_COMMON_FIELDS + 4][i]);
+}
+
+template <uint8_t FIELDS>
+void run_blocks(void (*block)(float* const*, size_t, V), float* data, size_t stride, float dt) {
+	float* rows[FIELDS];
+	for (uint8_t k = 0; k < FIELDS; ++k)
+		rows[k] = &data[k * stride];
+	const V v_dt(dt);
+	for (size_t i = 0; i < stride; i += V::WIDTH)
+		block(rows, i, v_dt);
+}
+
+} // namespace
+
+void madgwick_bank_update(float* data, size_t stride, float dt) {
+	run_blocks<BANK_COMMON_FIELDS + 1>(madgwick_block, data, stride, dt);
+}
+
+void mahony_bank_update(float* data, size_t stride, float dt) {
+	run_blocks<BANK_COMMON_FIELDS + 5>(mahony_block, data, stride, dt);
+}
+
+const char* bank_kernel() {
+#if defined(MPU9250_BANK_AVX)
+	return "avx";
+#elif defined(MPU9250_BANK_SSE2)
+	return "sse2";
+#elif defined(MPU9250_BANK_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+} // namespace MPU9250
@@ -0,0 +1,195 @@
+#include <FixedFilter.h>
+#include <MPU9250Utility.h>
+
+namespace MPU9250 {
+
+namespace {
+
+constexpr q24_t HALF {Q24_ONE / 2};
+
+inline q24_t mul(q24_t a, q24_t b) { return q24_mul(a, b); }
+
+// unit vector of a float vector, zero for zero
+void to_unit(float x, float y, float z, q24_t* v) {
+	float m = fabsf(x);
+	if (fabsf(y) > m) m = fabsf(y);
+	if (fabsf(z) > m) m = fabsf(z);
+	if (m == 0.f) {
+		v[0] = v[1] = v[2] = 0;
+		return;
+	}
+	const float s = 8388608.f / m;  // largest element 2^23 before normalizing
+	v[0] = (q24_t)(x * s);
+	v[1] = (q24_t)(y * s);
+	v[2] = (q24_t)(z * s);
+	q24_normalize(v, 3);
+}
+
+inline bool is_zero(const q24_t* v) {
+	return (v[0] | v[1] | v[2]) == 0;
+}
+
+// q += 0.5 q x (g dt), then normalized
+void integrate(q24_t* q, const q24_t* g, q24_t dt) {
+	const q24_t hx = mul(g[0], dt) / 2, hy = mul(g[1], dt) / 2, hz = mul(g[2], dt) / 2;
+	const q24_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	q[0] += -mul(q1, hx) - mul(q2, hy) - mul(q3, hz);
+	q[1] += mul(q0, hx) + mul(q2, hz) - mul(q3, hy);
+	q[2] += mul(q0, hy) - mul(q1, hz) + mul(q3, hx);
+	q[3] += mul(q0, hz) + mul(q1, hy) - mul(q2, hx);
+	q24_normalize(q, 4);
+}
+
+} // namespace
+
+void FixedFilter::update_impl(
+		float ax, float ay, float az,
+		float gx, float gy, float gz,
+		float mx, float my, float mz,
+		double deltaT, float* q)
+{
+	q24_t acc[3], mag[3];
+	to_unit(ax, ay, az, acc);
+	to_unit(mx, my, mz, mag);
+	const q24_t gyro[3] {to_q24(gx), to_q24(gy), to_q24(gz)};
+	sync_quaternion(q);
+	update_fixed(acc, gyro, mag, to_q24((float)deltaT));
+	write_quaternion(q);
+}
+
+void FixedFilter::sync_quaternion(const float* q) {
+	if (memcmp(q, q_written, sizeof(q_written)) == 0)
+		return;
+	for (uint8_t i = 0; i < 4; ++i)
+		qf[i] = to_q24(q[i]);
+	q24_normalize(qf, 4);
+}
+
+void FixedFilter::write_quaternion(float* q) {
+	for (uint8_t i = 0; i < 4; ++i)
+		q[i] = q_written[i] = from_q24(qf[i]);
+}
+
+void FixedSimpleFilter::update_fixed(const q24_t* /* acc */, const q24_t* gyro, const q24_t* /* mag */, q24_t dt) {
+	integrate(qf, gyro, dt);
+}
+
+void FixedMadgwickFilter::update_fixed(const q24_t* acc, const q24_t* gyro, const q24_t* mag, q24_t dt) {
+	// same algorithm and naming as BasicMadgwickFilter::update_impl()
+	if (is_zero(acc) || is_zero(mag))
+		return;
+	const q24_t ax = acc[0], ay = acc[1], az = acc[2];
+	const q24_t mx = mag[0], my = mag[1], mz = mag[2];
+	const q24_t q0 = qf[0], q1 = qf[1], q2 = qf[2], q3 = qf[3];
+	const q24_t gx = gyro[0], gy = gyro[1], gz = gyro[2];
+
+	// Rate of change of quaternion from gyroscope
+	q24_t qDot[4] {
+		(-mul(q1, gx) - mul(q2, gy) - mul(q3, gz)) / 2,
+		(mul(q0, gx) + mul(q2, gz) - mul(q3, gy)) / 2,
+		(mul(q0, gy) - mul(q1, gz) + mul(q3, gx)) / 2,
+		(mul(q0, gz) + mul(q1, gy) - mul(q2, gx)) / 2,
+	};
+
+	// Auxiliary variables to avoid repeated arithmetic
+	const q24_t _2q0mx = 2 * mul(q0, mx);
+	const q24_t _2q0my = 2 * mul(q0, my);
+	const q24_t _2q0mz = 2 * mul(q0, mz);
+	const q24_t _2q1mx = 2 * mul(q1, mx);
+	const q24_t _2q0 = 2 * q0, _2q1 = 2 * q1, _2q2 = 2 * q2, _2q3 = 2 * q3;
+	const q24_t q0q0 = mul(q0, q0), q0q1 = mul(q0, q1), q0q2 = mul(q0, q2), q0q3 = mul(q0, q3);
+	const q24_t q1q1 = mul(q1, q1), q1q2 = mul(q1, q2), q1q3 = mul(q1, q3);
+	const q24_t q2q2 = mul(q2, q2), q2q3 = mul(q2, q3), q3q3 = mul(q3, q3);
+	const q24_t _2q0q2 = 2 * q0q2, _2q2q3 = 2 * q2q3;
+
+	// Reference direction of Earth's magnetic field
+	const q24_t hx = mul(mx, q0q0) - mul(_2q0my, q3) + mul(_2q0mz, q2) + mul(mx, q1q1)
+	               + mul(mul(_2q1, my), q2) + mul(mul(_2q1, mz), q3) - mul(mx, q2q2) - mul(mx, q3q3);
+	const q24_t hy = mul(_2q0mx, q3) + mul(my, q0q0) - mul(_2q0mz, q1) + mul(_2q1mx, q2)
+	               - mul(my, q1q1) + mul(my, q2q2) + mul(mul(_2q2, mz), q3) - mul(my, q3q3);
+	const q24_t _2bx = q24_sqrt(mul(hx, hx) + mul(hy, hy));
+	const q24_t _2bz = -mul(_2q0mx, q2) + mul(_2q0my, q1) + mul(mz, q0q0) + mul(_2q1mx, q3)
+	                 - mul(mz, q1q1) + mul(mul(_2q2, my), q3) - mul(mz, q2q2) + mul(mz, q3q3);
+	const q24_t _4bx = 2 * _2bx, _4bz = 2 * _2bz;
+
+	// Gradient decent algorithm corrective step, on the shared residuals
+	const q24_t fa = 2 * q1q3 - _2q0q2 - ax;
+	const q24_t fb = 2 * q0q1 + _2q2q3 - ay;
+	const q24_t fc = Q24_ONE - 2 * q1q1 - 2 * q2q2 - az;
+	const q24_t fmx = mul(_2bx, HALF - q2q2 - q3q3) + mul(_2bz, q1q3 - q0q2) - mx;
+	const q24_t fmy = mul(_2bx, q1q2 - q0q3) + mul(_2bz, q0q1 + q2q3) - my;
+	const q24_t fmz = mul(_2bx, q0q2 + q1q3) + mul(_2bz, HALF - q1q1 - q2q2) - mz;
+	q24_t s[4] {
+		-mul(_2q2, fa) + mul(_2q1, fb) - mul(mul(_2bz, q2), fmx)
+			+ mul(-mul(_2bx, q3) + mul(_2bz, q1), fmy) + mul(mul(_2bx, q2), fmz),
+		mul(_2q3, fa) + mul(_2q0, fb) - mul(4 * q1, fc) + mul(mul(_2bz, q3), fmx)
+			+ mul(mul(_2bx, q2) + mul(_2bz, q0), fmy) + mul(mul(_2bx, q3) - mul(_4bz, q1), fmz),
+		-mul(_2q0, fa) + mul(_2q3, fb) - mul(4 * q2, fc) + mul(-mul(_4bx, q2) - mul(_2bz, q0), fmx)
+			+ mul(mul(_2bx, q1) + mul(_2bz, q3), fmy) + mul(mul(_2bx, q0) - mul(_4bz, q2), fmz),
+		mul(_2q1, fa) + mul(_2q2, fb) + mul(-mul(_4bx, q3) + mul(_2bz, q1), fmx)
+			+ mul(-mul(_2bx, q0) + mul(_2bz, q2), fmy) + mul(mul(_2bx, q1), fmz),
+	};
+
+	// Apply feedback step, none if the step is zero (the float filter gets NaN there)
+	if (q24_normalize(s, 4)) {
+		for (uint8_t i = 0; i < 4; ++i)
+			qDot[i] -= mul(beta, s[i]);
+	}
+
+	// Integrate rate of change of quaternion to yield quaternion
+	for (uint8_t i = 0; i < 4; ++i)
+		qf[i] += mul(qDot[i], dt);
+	q24_normalize(qf, 4);
+}
+
+void FixedMahonyFilter::update_fixed(const q24_t* a, const q24_t* gyro, const q24_t* /* mag */, q24_t dt) {
+	// same algorithm as MahonyFilter::update_impl()
+	q24_t g[3] {gyro[0], gyro[1], gyro[2]};
+	if (!is_zero(a)) {
+		const q24_t q0 = qf[0], q1 = qf[1], q2 = qf[2], q3 = qf[3];
+		// Estimated direction of gravity in the body frame (factor of two divided out)
+		const q24_t vx = mul(q1, q3) - mul(q0, q2);
+		const q24_t vy = mul(q0, q1) + mul(q2, q3);
+		const q24_t vz = mul(q0, q0) - HALF + mul(q3, q3);
+		// Error is cross product between estimated and measured direction of gravity
+		const q24_t e[3] {
+			mul(a[1], vz) - mul(a[2], vy),
+			mul(a[2], vx) - mul(a[0], vz),
+			mul(a[0], vy) - mul(a[1], vx),
+		};
+		if (Ki > 0) {
+			ix += mul(mul(Ki, e[0]), dt);
+			iy += mul(mul(Ki, e[1]), dt);
+			iz += mul(mul(Ki, e[2]), dt);
+			g[0] += ix;
+			g[1] += iy;
+			g[2] += iz;
+		}
+		for (uint8_t i = 0; i < 3; ++i)
+			g[i] += mul(Kp, e[i]);
+	}
+	integrate(qf, g, dt);
+}
+
+uint8_t FixedMahonyFilter::save_state(uint8_t* dest) const {
+	// the layout of MahonyFilter, so a state moves between the two
+	dest = put_f32(dest, from_q24(ix));
+	dest = put_f32(dest, from_q24(iy));
+	put_f32(dest, from_q24(iz));
+	return 12;
+}
+
+bool FixedMahonyFilter::load_state(const uint8_t* src, uint8_t size) {
+	if (size != 12)
+		return false;
+	float x, y, z;
+	src = get_f32(src, x);
+	src = get_f32(src, y);
+	get_f32(src, z);
+	ix = to_q24(x);
+	iy = to_q24(y);
+	iz = to_q24(z);
+	return true;
+}
+
+} // namespace MPU9250
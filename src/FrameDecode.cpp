@@ -0,0 +1,184 @@
+#include <FrameDecode.h>
+
+#if defined(MPU9250_DECODE_AVX2)
+#include <immintrin.h>
+#elif defined(MPU9250_DECODE_SSE2)
+#include <emmintrin.h>
+#elif defined(MPU9250_DECODE_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace MPU9250 {
+
+namespace {
+
+// 8 frames are 56 values, a whole number of 8 value loads, so the
+// per-value scales repeat every block
+constexpr uint8_t BLOCK_FRAMES {8};
+constexpr uint8_t BLOCK_WORDS {BLOCK_FRAMES * DECODE_FRAME_WORDS};
+
+inline int16_t be16(const uint8_t* p) {
+	return (int16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+void decode_tail(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	for (size_t i = 0; i < n_frames; ++i) {
+		// the whole frame first, dest may run into src
+		int16_t v[DECODE_FRAME_WORDS];
+		for (uint8_t j = 0; j < DECODE_FRAME_WORDS; ++j)
+			v[j] = be16(&src[2 * j]);
+		for (uint8_t j = 0; j < DECODE_FRAME_WORDS; ++j)
+			dest[j] = (float)v[j] * scale[j] + offset[j];
+		src += 2 * DECODE_FRAME_WORDS;
+		dest += DECODE_FRAME_WORDS;
+	}
+}
+
+#if defined(MPU9250_DECODE_AVX2) || defined(MPU9250_DECODE_SSE2) || defined(MPU9250_DECODE_NEON)
+void fill_block(const float* scale, const float* offset, float* block_scale, float* block_offset) {
+	for (uint8_t k = 0; k < BLOCK_WORDS; ++k) {
+		block_scale[k] = scale[k % DECODE_FRAME_WORDS];
+		block_offset[k] = offset[k % DECODE_FRAME_WORDS];
+	}
+}
+#endif
+
+} // namespace
+
+#if defined(MPU9250_DECODE_AVX2)
+
+void decode_be16(const uint8_t* src, size_t n, int16_t* dest) {
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)&src[2 * i]);
+		_mm_storeu_si128((__m128i*)&dest[i], _mm_shuffle_epi8(v, swap));
+	}
+	for (; i < n; ++i)
+		dest[i] = be16(&src[2 * i]);
+}
+
+void decode_frames(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	float bs[BLOCK_WORDS], bo[BLOCK_WORDS];
+	fill_block(scale, offset, bs, bo);
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	size_t i = 0;
+	for (; i + BLOCK_FRAMES <= n_frames; i += BLOCK_FRAMES) {
+		// all loads of the block before the stores
+		__m256 f[7];
+		for (uint8_t k = 0; k < 7; ++k) {
+			const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[16 * k]), swap);
+			f[k] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+		}
+		for (uint8_t k = 0; k < 7; ++k) {
+			const __m256 x = _mm256_mul_ps(f[k], _mm256_loadu_ps(&bs[8 * k]));
+			_mm256_storeu_ps(&dest[8 * k], _mm256_add_ps(x, _mm256_loadu_ps(&bo[8 * k])));
+		}
+		src += 2 * BLOCK_WORDS;
+		dest += BLOCK_WORDS;
+	}
+	decode_tail(src, n_frames - i, scale, offset, dest);
+}
+
+const char* decode_kernel() { return "avx2"; }
+
+#elif defined(MPU9250_DECODE_SSE2)
+
+namespace {
+
+inline __m128i swap16(__m128i v) {
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+} // namespace
+
+void decode_be16(const uint8_t* src, size_t n, int16_t* dest) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)&src[2 * i]);
+		_mm_storeu_si128((__m128i*)&dest[i], swap16(v));
+	}
+	for (; i < n; ++i)
+		dest[i] = be16(&src[2 * i]);
+}
+
+void decode_frames(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	float bs[BLOCK_WORDS], bo[BLOCK_WORDS];
+	fill_block(scale, offset, bs, bo);
+	size_t i = 0;
+	for (; i + BLOCK_FRAMES <= n_frames; i += BLOCK_FRAMES) {
+		__m128 f[14];
+		for (uint8_t k = 0; k < 7; ++k) {
+			const __m128i v = swap16(_mm_loadu_si128((const __m128i*)&src[16 * k]));
+			// sign extend: each value into the upper half of a 32 bit lane, shifted down
+			f[2 * k] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+			f[2 * k + 1] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+		}
+		for (uint8_t k = 0; k < 14; ++k) {
+			const __m128 x = _mm_mul_ps(f[k], _mm_loadu_ps(&bs[4 * k]));
+			_mm_storeu_ps(&dest[4 * k], _mm_add_ps(x, _mm_loadu_ps(&bo[4 * k])));
+		}
+		src += 2 * BLOCK_WORDS;
+		dest += BLOCK_WORDS;
+	}
+	decode_tail(src, n_frames - i, scale, offset, dest);
+}
+
+const char* decode_kernel() { return "sse2"; }
+
+#elif defined(MPU9250_DECODE_NEON)
+
+void decode_be16(const uint8_t* src, size_t n, int16_t* dest) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const uint8x16_t v = vrev16q_u8(vld1q_u8(&src[2 * i]));
+		vst1q_s16(&dest[i], vreinterpretq_s16_u8(v));
+	}
+	for (; i < n; ++i)
+		dest[i] = be16(&src[2 * i]);
+}
+
+void decode_frames(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	float bs[BLOCK_WORDS], bo[BLOCK_WORDS];
+	fill_block(scale, offset, bs, bo);
+	size_t i = 0;
+	for (; i + BLOCK_FRAMES <= n_frames; i += BLOCK_FRAMES) {
+		float32x4_t f[14];
+		for (uint8_t k = 0; k < 7; ++k) {
+			const int16x8_t v = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8(&src[16 * k])));
+			f[2 * k] = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+			f[2 * k + 1] = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+		}
+		// separate multiply and add, vmlaq_f32 may fuse and round differently
+		for (uint8_t k = 0; k < 14; ++k) {
+			const float32x4_t x = vmulq_f32(f[k], vld1q_f32(&bs[4 * k]));
+			vst1q_f32(&dest[4 * k], vaddq_f32(x, vld1q_f32(&bo[4 * k])));
+		}
+		src += 2 * BLOCK_WORDS;
+		dest += BLOCK_WORDS;
+	}
+	decode_tail(src, n_frames - i, scale, offset, dest);
+}
+
+const char* decode_kernel() { return "neon"; }
+
+#else
+
+void decode_be16(const uint8_t* src, size_t n, int16_t* dest) {
+	for (size_t i = 0; i < n; ++i)
+		dest[i] = be16(&src[2 * i]);
+}
+
+void decode_frames(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	decode_tail(src, n_frames, scale, offset, dest);
+}
+
+const char* decode_kernel() { return "scalar"; }
+
+#endif
+
+void decode_frames_scalar(const uint8_t* src, size_t n_frames, const float* scale, const float* offset, float* dest) {
+	decode_tail(src, n_frames, scale, offset, dest);
+}
+
+} // namespace MPU9250
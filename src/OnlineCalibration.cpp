@@ -0,0 +1,161 @@
+#include <OnlineCalibration.h>
+#include <math.h>
+
+namespace MPU9250 {
+
+void MagCalibrator::reset() {
+	// start from a 0.5 G sphere around the origin
+	const float theta0[N] {1.f, 1.f, 0.f, 0.f, 0.f, -0.25f};
+	for (uint8_t i = 0; i < N; ++i) {
+		theta[i] = theta0[i];
+		for (uint8_t j = 0; j < N; ++j)
+			P[i][j] = (i == j) ? P_INIT : 0.f;
+	}
+	for (uint8_t i = 0; i < 3; ++i) {
+		last[i] = center[i] = bias[i] = 0.f;
+		scale[i] = 1.f;
+		lo[i] = +1e9f;
+		hi[i] = -1e9f;
+	}
+	n_used = 0;
+	converged = false;
+}
+
+bool MagCalibrator::update(float mx, float my, float mz) {
+	const float x[3] {mx * UNIT, my * UNIT, mz * UNIT};
+	if (n_used > 0) {
+		float d0 = x[0] - last[0], d1 = x[1] - last[1], d2 = x[2] - last[2];
+		float step = min_step * UNIT;
+		if (d0 * d0 + d1 * d1 + d2 * d2 < step * step)
+			return false;
+	}
+	for (uint8_t i = 0; i < 3; ++i) {
+		last[i] = x[i];
+		if (x[i] < lo[i]) lo[i] = x[i];
+		if (x[i] > hi[i]) hi[i] = x[i];
+	}
+
+	// regressor and target of -x^2 = phi . theta
+	const float phi[N] {x[1] * x[1], x[2] * x[2], x[0], x[1], x[2], 1.f};
+	const float target = -x[0] * x[0];
+
+	float p_phi[N];
+	float denom = 0.f, predicted = 0.f, trace = 0.f;
+	for (uint8_t i = 0; i < N; ++i) {
+		p_phi[i] = 0.f;
+		for (uint8_t j = 0; j < N; ++j)
+			p_phi[i] += P[i][j] * phi[j];
+		denom += phi[i] * p_phi[i];
+		predicted += phi[i] * theta[i];
+		trace += P[i][i];
+	}
+	// stop forgetting once the covariance is large, there is nothing left to forget
+	const float lambda = (trace > P_TRACE_MAX) ? 1.f : forgetting;
+	denom += lambda;
+	const float err = target - predicted;
+	for (uint8_t i = 0; i < N; ++i)
+		theta[i] += p_phi[i] / denom * err;
+	for (uint8_t i = 0; i < N; ++i) {
+		for (uint8_t j = i; j < N; ++j) {
+			P[i][j] = (P[i][j] - p_phi[i] * p_phi[j] / denom) / lambda;
+			P[j][i] = P[i][j];
+		}
+	}
+
+	if (++n_used < min_samples)
+		return false;
+
+	float c[3], r[3];
+	if (!solve(c, r))
+		return false;
+	const float r_avg = (r[0] + r[1] + r[2]) / 3.f;
+	float d0 = c[0] - center[0], d1 = c[1] - center[1], d2 = c[2] - center[2];
+	const bool stable = (d0 * d0 + d1 * d1 + d2 * d2) < (tolerance * r_avg) * (tolerance * r_avg);
+	for (uint8_t i = 0; i < 3; ++i)
+		center[i] = c[i];
+	if (!stable)
+		return false;
+	for (uint8_t i = 0; i < 3; ++i) {
+		if (hi[i] - c[i] < coverage * r[i] || c[i] - lo[i] < coverage * r[i])
+			return false;
+	}
+
+	for (uint8_t i = 0; i < 3; ++i) {
+		bias[i] = c[i] / UNIT;
+		scale[i] = r_avg / r[i];
+	}
+	converged = true;
+	return true;
+}
+
+bool MagCalibrator::solve(float* c, float* r) const {
+	if (theta[0] <= 0.f || theta[1] <= 0.f)
+		return false;
+	c[0] = -0.5f * theta[2];
+	c[1] = -0.5f * theta[3] / theta[0];
+	c[2] = -0.5f * theta[4] / theta[1];
+	const float g = c[0] * c[0] + theta[0] * c[1] * c[1] + theta[1] * c[2] * c[2] - theta[5];
+	if (g <= 0.f)
+		return false;
+	r[0] = sqrtf(g);
+	r[1] = sqrtf(g / theta[0]);
+	r[2] = sqrtf(g / theta[1]);
+	return true;
+}
+
+void GyroBiasEstimator::reset() {
+	for (uint8_t i = 0; i < 3; ++i)
+		acc_mean[i] = gyro_mean[i] = bias[i] = 0.f;
+	acc_var = gyro_var = 0.f;
+	n_still = 0;
+	has_mean = false;
+}
+
+bool GyroBiasEstimator::update(const float* acc, const float* gyro) {
+	if (!has_mean) {
+		for (uint8_t i = 0; i < 3; ++i) {
+			acc_mean[i] = acc[i];
+			gyro_mean[i] = gyro[i];
+		}
+		has_mean = true;
+		return false;
+	}
+
+	// exponentially weighted variance, updated with the error to the old mean
+	float acc_sq = 0.f, gyro_sq = 0.f, rate_sq = 0.f;
+	for (uint8_t i = 0; i < 3; ++i) {
+		float da = acc[i] - acc_mean[i];
+		float dg = gyro[i] - gyro_mean[i];
+		acc_mean[i] += alpha * da;
+		gyro_mean[i] += alpha * dg;
+		acc_sq += da * da;
+		gyro_sq += dg * dg;
+		rate_sq += gyro_mean[i] * gyro_mean[i];
+	}
+	acc_var = (1.f - alpha) * (acc_var + alpha * acc_sq);
+	gyro_var = (1.f - alpha) * (gyro_var + alpha * gyro_sq);
+
+	const bool still = acc_var < acc_threshold * acc_threshold
+	                && gyro_var < gyro_threshold * gyro_threshold
+	                && rate_sq < max_rate * max_rate;
+	if (!still) {
+		n_still = 0;
+		return false;
+	}
+	if (n_still < hold_samples) {
+		++n_still;
+		return false;
+	}
+	for (uint8_t i = 0; i < 3; ++i)
+		bias[i] += bias_alpha * (gyro[i] - bias[i]);
+	return true;
+}
+
+void GyroBiasEstimator::shift(const float* d) {
+	for (uint8_t i = 0; i < 3; ++i) {
+		bias[i] -= d[i];
+		gyro_mean[i] -= d[i];
+	}
+}
+
+} // namespace MPU9250
@@ -1,19 +1,29 @@
+#ifdef ARDUINO
 #include <Arduino.h>
+#endif
 #include <QuaternionFilter.h>
-#include "utility.h"
+#include <MPU9250Utility.h>
 
 namespace MPU9250 {
 
 void Filter::update(float ax, float ay, float az,
                     float gx, float gy, float gz,
-                    float mx, float my, float mz, float* q){
-		newTime = micros();
-		deltaT = newTime - oldTime;
-		oldTime = newTime;
-		deltaT = fabs(deltaT * 0.001 * 0.001);
+                    float mx, float my, float mz,
+                    uint32_t time_us, float* q){
+		double deltaT = has_time ? (time_us - last_time_us) * 0.001 * 0.001 : 0.;
+		last_time_us = time_us;
+		has_time = true;
 		this->update_impl(ax, ay, az, gx, gy, gz, mx, my, mz, deltaT, q);
 }
 
+#ifdef ARDUINO
+void Filter::update(float ax, float ay, float az,
+                    float gx, float gy, float gz,
+                    float mx, float my, float mz, float* q){
+		update(ax, ay, az, gx, gy, gz, mx, my, mz, (uint32_t)micros(), q);
+}
+#endif
+
 void SimpleFilter::update_impl(
 		float ax, float ay, float az,
 		float gx, float gy, float gz,
@@ -26,33 +36,49 @@ void SimpleFilter::update_impl(
 	q[1] += 0.5f * (q0 * gx + q2 * gz - q3 * gy) * deltaT;
 	q[2] += 0.5f * (q0 * gy - q1 * gz + q3 * gx) * deltaT;
 	q[3] += 0.5f * (q0 * gz + q1 * gy - q2 * gx) * deltaT;
-	float recipNorm = 1.0 / sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	float recipNorm = inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
 	q[0] *= recipNorm;
 	q[1] *= recipNorm;
 	q[2] *= recipNorm;
 	q[3] *= recipNorm;
 }
 
-MadgwickFilter::MadgwickFilter(){
+namespace {
+inline float real_sqrt(float x) { return sqrtf(x); }
+inline double real_sqrt(double x) { return sqrt(x); }
+inline float real_inv_sqrt(float x) { return inv_sqrt(x); }
+inline double real_inv_sqrt(double x) { return 1.0 / sqrt(x); }
+} // namespace
+
+template <typename Real>
+BasicMadgwickFilter<Real>::BasicMadgwickFilter(){
 	GyroMeasError = pi * (40.0f / 180.0f);
 	GyroMeasDrift = pi * (0.0f / 180.0f);
 	beta = sqrt(3.0f / 4.0f) * GyroMeasError;
 	zeta = sqrt(3.0f / 4.0f) * GyroMeasDrift;
 }
 
-void MadgwickFilter::update_impl(
+template <typename Real>
+void BasicMadgwickFilter<Real>::setGyroMeasError(float error) {
+	GyroMeasError = error;
+	beta = sqrt(3.0f / 4.0f) * GyroMeasError;
+}
+
+template <typename Real>
+void BasicMadgwickFilter<Real>::update_impl(
 		float ax, float ay, float az,
 		float gx, float gy, float gz,
 		float mx, float my, float mz,
 		double deltaT, float* q)
 {
 	// short name local variable for readability
-	double q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
-	double recipNorm;
-	double s0, s1, s2, s3;
-	double qDot1, qDot2, qDot3, qDot4;
-	double hx, hy;
-	double _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q0,
+	Real q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	Real dt = deltaT;
+	Real recipNorm;
+	Real s0, s1, s2, s3;
+	Real qDot1, qDot2, qDot3, qDot4;
+	Real hx, hy;
+	Real _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q0,
 				 _2q1, _2q2, _2q3, _2q0q2, _2q2q3, q0q0, q0q1, q0q2, q0q3, q1q1,
 				 q1q2, q1q3, q2q2, q2q3, q3q3;
 
@@ -63,17 +89,17 @@ void MadgwickFilter::update_impl(
 	qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
 
 	// Normalise accelerometer measurement
-	double a_norm = ax * ax + ay * ay + az * az;
-	if (a_norm == 0.) return;  // handle NaN
-	recipNorm = 1.0 / sqrt(a_norm);
+	Real a_norm = ax * ax + ay * ay + az * az;
+	if (a_norm == Real(0)) return;  // handle NaN
+	recipNorm = real_inv_sqrt(a_norm);
 	ax *= recipNorm;
 	ay *= recipNorm;
 	az *= recipNorm;
 
 	// Normalise magnetometer measurement
-	double m_norm = mx * mx + my * my + mz * mz;
-	if (m_norm == 0.) return;  // handle NaN
-	recipNorm = 1.0 / sqrt(m_norm);
+	Real m_norm = mx * mx + my * my + mz * mz;
+	if (m_norm == Real(0)) return;  // handle NaN
+	recipNorm = real_inv_sqrt(m_norm);
 	mx *= recipNorm;
 	my *= recipNorm;
 	mz *= recipNorm;
@@ -103,7 +129,7 @@ void MadgwickFilter::update_impl(
 	// Reference direction of Earth's magnetic field
 	hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
 	hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
-	_2bx = sqrt(hx * hx + hy * hy);
+	_2bx = real_sqrt(hx * hx + hy * hy);
 	_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
 	_4bx = 2.0f * _2bx;
 	_4bz = 2.0f * _2bz;
@@ -113,7 +139,7 @@ void MadgwickFilter::update_impl(
 	s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
 	s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
 	s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
-	recipNorm = 1.0 / sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);  // normalise step magnitude
+	recipNorm = real_inv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);  // normalise step magnitude
 	s0 *= recipNorm;
 	s1 *= recipNorm;
 	s2 *= recipNorm;
@@ -126,24 +152,27 @@ void MadgwickFilter::update_impl(
 	qDot4 -= beta * s3;
 
 	// Integrate rate of change of quaternion to yield quaternion
-	q0 += qDot1 * deltaT;
-	q1 += qDot2 * deltaT;
-	q2 += qDot3 * deltaT;
-	q3 += qDot4 * deltaT;
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
 	// Normalise quaternion
-	recipNorm = 1.0 / sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	recipNorm = real_inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
 	q0 *= recipNorm;
 	q1 *= recipNorm;
 	q2 *= recipNorm;
 	q3 *= recipNorm;
 
-	q[0] = q0;
-	q[1] = q1;
-	q[2] = q2;
-	q[3] = q3;
+	q[0] = (float)q0;
+	q[1] = (float)q1;
+	q[2] = (float)q2;
+	q[3] = (float)q3;
 }
 
+template class BasicMadgwickFilter<float>;
+template class BasicMadgwickFilter<double>;
+
 void MahonyFilter::update_impl(
 		float ax, float ay, float az,
 		float gx, float gy, float gz,
@@ -154,14 +183,13 @@ void MahonyFilter::update_impl(
 	float vx, vy, vz;
 	float ex, ey, ez;  //error terms
 	float qa, qb, qc;
-	static float ix = 0.0, iy = 0.0, iz = 0.0;  //integral feedback terms
 	float tmp;
 
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	tmp = ax * ax + ay * ay + az * az;
 	if (tmp > 0.0) {
 		// Normalise accelerometer (assumed to measure the direction of gravity in body frame)
-		recipNorm = 1.0 / sqrt(tmp);
+		recipNorm = inv_sqrt(tmp);
 		ax *= recipNorm;
 		ay *= recipNorm;
 		az *= recipNorm;
@@ -207,11 +235,27 @@ void MahonyFilter::update_impl(
 	q[3] += (qa * gz + qb * gy - qc * gx);
 
 	// renormalise quaternion
-	recipNorm = 1.0 / sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	recipNorm = inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
 	q[0] = q[0] * recipNorm;
 	q[1] = q[1] * recipNorm;
 	q[2] = q[2] * recipNorm;
 	q[3] = q[3] * recipNorm;
 }
 
+uint8_t MahonyFilter::save_state(uint8_t* dest) const {
+	dest = put_f32(dest, ix);
+	dest = put_f32(dest, iy);
+	put_f32(dest, iz);
+	return 12;
+}
+
+bool MahonyFilter::load_state(const uint8_t* src, uint8_t size) {
+	if (size != 12)
+		return false;
+	src = get_f32(src, ix);
+	src = get_f32(src, iy);
+	get_f32(src, iz);
+	return true;
+}
+
 } // namespace MPU9250
@@ -1,19 +0,0 @@
-#ifndef MPU_UTILITY_H
-#define MPU_UTILITY_H
-
-namespace MPU9250 {
-
-// #define PI 3.1415926535897932384626433832795
-// #define HALF_PI 1.5707963267948966192313216916398
-// #define TWO_PI 6.283185307179586476925286766559
-// #define DEG_TO_RAD 0.017453292519943295769236907684886
-// #define RAD_TO_DEG 57.295779513082320876798154814105
-
-constexpr float pi = 3.1415926535897932384626433832795;
-	
-inline float deg_to_rad(float angle){
-	return angle * 0.017453292519943295769236907684886;
-}
-} // namespace MPU9250 {
-
-#endif // MPU_UTILITY_H